@@ -4,7 +4,34 @@ CONFIG += console c++17
 CONFIG -= app_bundle
 
 SOURCES += \
-        main.cpp
+        batch.cpp \
+        defectmap.cpp \
+        detectors.cpp \
+        image.cpp \
+        kernels.cpp \
+        kernels_avx2.cpp \
+        kernels_sse41.cpp \
+        main.cpp \
+        mappedfile.cpp \
+        metrics.cpp \
+        output.cpp \
+        temporal.cpp \
+        threadpool.cpp \
+        watch.cpp
+
+HEADERS += \
+        batch.h \
+        defectmap.h \
+        detectors.h \
+        image.h \
+        kernels.h \
+        mappedfile.h \
+        metrics.h \
+        output.h \
+        stencil.h \
+        temporal.h \
+        threadpool.h \
+        watch.h
 
 #libtif
 include(C:/Qt/5.15.2/Src/qtimageformats/src/3rdparty/libtiff.pri)
@@ -0,0 +1,286 @@
+#include "batch.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include "temporal.h"
+#include "threadpool.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+
+// Количество кадров в обработке: один декодируется, один проверяется, один выводится
+const size_t pipelineDepth = 3;
+
+/*!
+ * \brief Очередь кадров между стадиями конвейера.
+ * Размер очередей ограничен числом кадров в пуле, поэтому стадии не убегают друг от друга.
+ */
+class FrameQueue {
+public:
+    void push(Frame* frame) {
+        {
+            lock_guard<mutex> lock(m);
+            frames.push(frame);
+        }
+        ready.notify_one();
+    }
+
+    // Следующий кадр или nullptr, если очередь закрыта и пуста
+    Frame* pop() {
+        unique_lock<mutex> lock(m);
+        ready.wait(lock, [this] { return closed || !frames.empty(); });
+        if(frames.empty())
+            return nullptr;
+        Frame* frame = frames.front();
+        frames.pop();
+        return frame;
+    }
+
+    void close() {
+        {
+            lock_guard<mutex> lock(m);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+private:
+    mutex m;
+    condition_variable ready;
+    queue<Frame*> frames;
+    bool closed = false;
+};
+
+// Сравнение имени файла с шаблоном из символов * и ?
+bool matchWildcard(const char* pattern, const char* name) {
+    if(*pattern == '\0')
+        return *name == '\0';
+    if(*pattern == '*')
+        return matchWildcard(pattern + 1, name) || (*name != '\0' && matchWildcard(pattern, name + 1));
+    if(*name == '\0')
+        return false;
+    return (*pattern == '?' || *pattern == *name) && matchWildcard(pattern + 1, name + 1);
+}
+
+/*!
+ * \brief Декодирование кадра в растр его типа: несжатые файлы отображаются в память, остальные читаются в буфер
+ * \param frame - кадр с заполненным путём
+ * \param raster - растр кадра для типа пикселей файла
+ * \param pool - пул потоков для декодирования
+ */
+template<typename Pixel>
+void decodeRaster(Frame& frame, FrameRaster<Pixel>& raster, ThreadPool& pool, FrameMetrics* metrics) {
+    if(raster.mapped.open(frame.path.c_str())) {
+        frame.w = raster.mapped.width();
+        frame.h = raster.mapped.height();
+        raster.rows = {raster.mapped.data(), raster.mapped.stride(), 0};
+        frame.errCode = 0;
+        return;
+    }
+    frame.errCode = getImage(frame.path.c_str(), raster.buffer, frame.w, frame.h, &pool);
+    raster.rows = {raster.buffer.data(), frame.w, 0};
+    if(metrics && frame.errCode == 0)
+        metrics->bytesDecoded += raster.buffer.size() * sizeof(Pixel);
+}
+
+// Декодирование кадра: тип пикселей определяется по файлу (см. decodeRaster)
+void decodeFrame(Frame& frame, ThreadPool& pool, FrameMetrics* metrics) {
+    StageTimer timer(metrics, STAGE_DECODE);
+    frame.errCode = getPixelType(frame.path.c_str(), frame.type);
+    if(frame.errCode != 0)
+        return;
+    switch(frame.type) {
+    case PIXEL_UINT8:
+        decodeRaster(frame, frame.raster8, pool, metrics);
+        break;
+    case PIXEL_UINT16:
+        decodeRaster(frame, frame.raster16, pool, metrics);
+        break;
+    case PIXEL_FLOAT:
+        decodeRaster(frame, frame.rasterFloat, pool, metrics);
+        break;
+    }
+}
+
+/*!
+ * \brief Поиск битых пикселей кадра и добавление кадра в статистику последовательности
+ * \param frame - декодированный кадр
+ * \param raster - растр кадра
+ */
+template<typename Pixel>
+void searchRaster(Frame& frame, const FrameRaster<Pixel>& raster, const uint16 threshold, uint8 methods, ThreadPool& pool,
+                  TemporalMap* temporal, FrameMetrics* metrics) {
+    const auto start = chrono::steady_clock::now();
+    if(temporal)
+        frame.errCode = accumulatingSearch(raster.rows, frame.w, frame.h, threshold, methods, frame.brokenPixels, *temporal, &pool, metrics);
+    else
+        fusedBrokenPixelSearch(raster.rows, frame.w, frame.h, threshold, methods, frame.brokenPixels, &pool, metrics);
+    const uint64 ns = elapsedNanoseconds(start);
+    frame.milliseconds = ns / 1e6;
+    if(metrics)
+        metrics->stageNs[STAGE_DETECT] += ns;
+}
+
+// Освобождение результатов кадра перед повторным использованием
+void resetFrame(Frame& frame) {
+    for(uint8 m = 0; m < numberOfMethods; m++) {
+        delete frame.brokenPixels[m];
+        frame.brokenPixels[m] = nullptr;
+    }
+    frame.raster8.mapped.close();
+    frame.raster16.mapped.close();
+    frame.rasterFloat.mapped.close();
+    frame.metrics.reset();
+}
+
+} // namespace
+
+// Проверка расширения .tif/.tiff без учёта регистра
+bool isTiff(const string& path) {
+    string ext = fs::path(path).extension().string();
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return char(tolower(c)); });
+    return ext == ".tif" || ext == ".tiff";
+}
+
+/*!
+ * \brief Проверка того, что путь задаёт набор кадров: папку, шаблон имени с * и ? или список файлов вида @list.txt
+ * \param spec - путь из командной строки
+ * \return true для набора кадров
+ */
+bool isBatchSpec(const string& spec) {
+    if(spec.empty())
+        return false;
+    if(spec[0] == '@' || spec.find_first_of("*?") != string::npos)
+        return true;
+    error_code ec;
+    return fs::is_directory(spec, ec);
+}
+
+/*!
+ * \brief Получение списка кадров.
+ * Для папки берутся все файлы .tif/.tiff, для шаблона - файлы папки с подходящими именами,
+ * в обоих случаях по алфавиту. Список файлов читается построчно в исходном порядке.
+ * \param spec - папка, шаблон или @список
+ * \param paths - пути кадров
+ * \return В случае успеха вернёт true, иначе false (не удалось прочитать папку или список)
+ */
+bool listFrames(const string& spec, vector<string>& paths) {
+    paths.clear();
+    if(spec[0] == '@') {
+        ifstream list(spec.substr(1));
+        if(!list)
+            return false;
+        string line;
+        while(getline(list, line)) {
+            if(!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if(!line.empty())
+                paths.push_back(line);
+        }
+        return true;
+    }
+
+    error_code ec;
+    fs::path dir = spec;
+    string pattern;
+    if(!fs::is_directory(dir, ec)) {
+        pattern = dir.filename().string();
+        dir = dir.parent_path();
+        if(dir.empty())
+            dir = ".";
+    }
+    for(fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        if(!it->is_regular_file(ec))
+            continue;
+        const fs::path& file = it->path();
+        if(pattern.empty() ? isTiff(file.string()) : matchWildcard(pattern.c_str(), file.filename().string().c_str()))
+            paths.push_back(file.string());
+    }
+    if(ec)
+        return false;
+    sort(paths.begin(), paths.end());
+    return true;
+}
+
+/*!
+ * \brief Обработка кадров конвейером из трёх стадий: декодирование, поиск, вывод.
+ * Стадии работают одновременно над соседними кадрами, так что следующий кадр декодируется,
+ * пока проверяется текущий. Кадры с буферами растра берутся из пула фиксированного размера,
+ * поэтому память выделяется только на первых кадрах (и при увеличении размера изображения).
+ * Источник может ждать появления следующего кадра: конвейер и его буферы живут до конца источника.
+ * \param next - источник путей кадров, вызывается из потока декодирования
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param pool - пул потоков, общий для декодирования и поиска
+ * \param emit - вывод результатов кадра, вызывается в порядке поступления кадров из отдельного потока
+ * \param temporal - статистика последовательности, в которую добавляется каждый кадр (nullptr - не накапливать)
+ * \param collectMetrics - заполнять показатели кадров (Frame::metrics) для emit
+ */
+void runPipeline(const FrameSource& next, const uint16 threshold, uint8 methods, ThreadPool& pool,
+                 const function<void(Frame&)>& emit, TemporalMap* temporal, bool collectMetrics) {
+    Frame frames[pipelineDepth];
+    FrameQueue freeFrames, decoded, detected;
+    for(Frame& frame : frames)
+        freeFrames.push(&frame);
+
+    thread decoder([&] {
+        string path;
+        while(next(path)) {
+            Frame* frame = freeFrames.pop();
+            frame->path = path;
+            decodeFrame(*frame, pool, collectMetrics ? &frame->metrics : nullptr);
+            decoded.push(frame);
+        }
+        decoded.close();
+    });
+    thread emitter([&] {
+        while(Frame* frame = detected.pop()) {
+            emit(*frame);
+            resetFrame(*frame);
+            freeFrames.push(frame);
+        }
+    });
+
+    while(Frame* frame = decoded.pop()) {
+        if(frame->errCode == 0) {
+            FrameMetrics* metrics = collectMetrics ? &frame->metrics : nullptr;
+            switch(frame->type) {
+            case PIXEL_UINT8:
+                searchRaster(*frame, frame->raster8, threshold, methods, pool, temporal, metrics);
+                break;
+            case PIXEL_UINT16:
+                searchRaster(*frame, frame->raster16, threshold, methods, pool, temporal, metrics);
+                break;
+            case PIXEL_FLOAT:
+                searchRaster(*frame, frame->rasterFloat, threshold, methods, pool, temporal, metrics);
+                break;
+            }
+        }
+        detected.push(frame);
+    }
+    detected.close();
+    decoder.join();
+    emitter.join();
+}
+
+/*!
+ * \brief Пакетная обработка списка кадров (см. runPipeline)
+ * \param paths - пути кадров
+ */
+void runBatch(const vector<string>& paths, const uint16 threshold, uint8 methods, ThreadPool& pool,
+              const function<void(Frame&)>& emit, TemporalMap* temporal, bool collectMetrics) {
+    size_t index = 0;
+    runPipeline([&](string& path) {
+        if(index >= paths.size())
+            return false;
+        path = paths[index++];
+        return true;
+    }, threshold, methods, pool, emit, temporal, collectMetrics);
+}
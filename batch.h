@@ -0,0 +1,54 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "detectors.h"
+#include "image.h"
+#include "metrics.h"
+
+class TemporalMap;
+class ThreadPool;
+
+/*!
+ * \brief Растр кадра с пикселями типа Pixel
+ */
+template<typename Pixel>
+struct FrameRaster {
+    std::vector<Pixel> buffer;      // Буфер декодированного изображения
+    BasicMappedImage<Pixel> mapped; // Несжатое изображение, если удалось отобразить в память
+    BasicRasterRows<Pixel> rows = {nullptr, 0, 0};
+};
+
+/*!
+ * \brief Кадр пакетной обработки. Кадры с буферами переиспользуются от файла к файлу.
+ * Для каждого типа пикселей свой растр: в наборе могут быть кадры разной разрядности,
+ * и буфер каждого типа выделяется только при появлении кадра этого типа.
+ */
+struct Frame {
+    std::string path;
+    uint8 errCode = 0;       // Код ошибки getImage или TemporalMap::accumulate, 0 - кадр обработан
+    uint32 w = 0, h = 0;
+    double milliseconds = 0; // Время поиска битых пикселей
+    DefectMap* brokenPixels[numberOfMethods] = {nullptr};
+
+    PixelType type = PIXEL_UINT16; // Тип пикселей декодированного кадра
+    FrameRaster<uint8> raster8;
+    FrameRaster<uint16> raster16;
+    FrameRaster<float> rasterFloat;
+    FrameMetrics metrics;       // Показатели кадра (заполняются, если конвейер собирает показатели)
+};
+
+// Источник путей кадров: записывает путь следующего кадра в path, false - кадров больше не будет
+typedef std::function<bool(std::string& path)> FrameSource;
+
+bool isTiff(const std::string& path);
+bool isBatchSpec(const std::string& spec);
+bool listFrames(const std::string& spec, std::vector<std::string>& paths);
+void runPipeline(const FrameSource& next, const uint16 threshold, uint8 methods, ThreadPool& pool,
+                 const std::function<void(Frame&)>& emit, TemporalMap* temporal = nullptr, bool collectMetrics = false);
+void runBatch(const std::vector<std::string>& paths, const uint16 threshold, uint8 methods, ThreadPool& pool,
+              const std::function<void(Frame&)>& emit, TemporalMap* temporal = nullptr, bool collectMetrics = false);
+
+#endif // BATCH_H
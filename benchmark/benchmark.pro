@@ -0,0 +1,38 @@
+QT -= gui
+
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+TARGET = benchmark
+INCLUDEPATH += ..
+
+SOURCES += \
+        ../defectmap.cpp \
+        ../detectors.cpp \
+        ../kernels.cpp \
+        ../kernels_avx2.cpp \
+        ../kernels_sse41.cpp \
+        ../metrics.cpp \
+        ../threadpool.cpp \
+        generator.cpp \
+        main.cpp
+
+HEADERS += \
+        ../defectmap.h \
+        ../detectors.h \
+        ../kernels.h \
+        ../metrics.h \
+        ../stencil.h \
+        ../threadpool.h \
+        generator.h
+
+#libtif
+include(C:/Qt/5.15.2/Src/qtimageformats/src/3rdparty/libtiff.pri)
+win32-g++:
+{
+        LIBS += -lz
+}
+win32-msvc*
+{
+        HEADERS += C:/Qt/5.15.2/msvc2015_64/include/QtZlib/zlib.h
+}
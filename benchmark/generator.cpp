@@ -0,0 +1,70 @@
+#include "generator.h"
+#include <algorithm>
+#include <random>
+
+using namespace std;
+
+namespace {
+
+// Внедрение битого пикселя: горячий насыщается, мёртвый не реагирует на свет
+void plant(SyntheticFrame& frame, uint32 x, uint32 y, uint16 value) {
+    const size_t index = size_t(y) * frame.width + x;
+    frame.raster[index] = value;
+    frame.defects.push_back(index);
+}
+
+} // namespace
+
+/*!
+ * \brief Генерация кадра: плавный фон с гауссовым шумом и внедрёнными битыми пикселями.
+ * Горячие пиксели имеют значение 0xffff, мёртвые - 0; кластеры - это группы горячих пикселей
+ * 2*2 или 1*3, на которых методы со скользящим окном ошибаются чаще всего.
+ * Битые пиксели ставятся не ближе 2 пикселей к краю, где методы их не проверяют.
+ * \param settings - параметры кадра
+ * \return Кадр и индексы внедрённых битых пикселей
+ */
+SyntheticFrame generateFrame(const GeneratorSettings& settings) {
+    SyntheticFrame frame;
+    frame.width = settings.width;
+    frame.height = settings.height;
+    frame.raster.resize(size_t(frame.width) * frame.height);
+
+    mt19937 rng(settings.seed);
+    normal_distribution<double> noise(0.0, settings.noise);
+    const double slope = settings.level * settings.gradient / max(1u, frame.width + frame.height);
+    for(uint32 y = 0; y < frame.height; y++) {
+        uint16* row = frame.raster.data() + size_t(y) * frame.width;
+        for(uint32 x = 0; x < frame.width; x++) {
+            const double value = settings.level + slope * (x + y) + noise(rng);
+            row[x] = uint16(min(65535.0, max(0.0, value)));
+        }
+    }
+
+    if(frame.width < 8 || frame.height < 8)
+        return frame;
+    uniform_int_distribution<uint32> randomX(2, frame.width - 5);
+    uniform_int_distribution<uint32> randomY(2, frame.height - 4);
+    for(uint32 i = 0; i < settings.hot; i++)
+        plant(frame, randomX(rng), randomY(rng), 0xffff);
+    for(uint32 i = 0; i < settings.dead; i++)
+        plant(frame, randomX(rng), randomY(rng), 0);
+    for(uint32 i = 0; i < settings.clusters; i++) {
+        const uint32 x = randomX(rng), y = randomY(rng);
+        if(rng() % 2) {
+            plant(frame, x, y, 0xffff);
+            plant(frame, x + 1, y, 0xffff);
+            plant(frame, x, y + 1, 0xffff);
+            plant(frame, x + 1, y + 1, 0xffff);
+        }
+        else {
+            plant(frame, x, y, 0xffff);
+            plant(frame, x + 1, y, 0xffff);
+            plant(frame, x + 2, y, 0xffff);
+        }
+    }
+
+    // Пиксели могли попасть в одно место несколько раз
+    sort(frame.defects.begin(), frame.defects.end());
+    frame.defects.erase(unique(frame.defects.begin(), frame.defects.end()), frame.defects.end());
+    return frame;
+}
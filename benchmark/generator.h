@@ -0,0 +1,34 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <vector>
+#include "tiffio.h"
+
+/*!
+ * \brief Параметры синтетического кадра
+ */
+struct GeneratorSettings {
+    uint32 width = 4096;
+    uint32 height = 3072;
+    uint16 level = 20000;   // Средний уровень фона
+    double gradient = 0.25; // Доля уровня, на которую фон плавно меняется по кадру
+    double noise = 150;     // СКО гауссова шума
+    uint32 hot = 200;       // Количество горячих пикселей
+    uint32 dead = 200;      // Количество мёртвых пикселей
+    uint32 clusters = 50;   // Количество кластеров горячих пикселей
+    uint32 seed = 1;
+};
+
+/*!
+ * \brief Синтетический кадр с известным расположением битых пикселей
+ */
+struct SyntheticFrame {
+    uint32 width = 0;
+    uint32 height = 0;
+    std::vector<uint16> raster;
+    std::vector<size_t> defects; // Индексы внедрённых битых пикселей по возрастанию
+};
+
+SyntheticFrame generateFrame(const GeneratorSettings& settings);
+
+#endif // GENERATOR_H
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "defectmap.h"
+#include "detectors.h"
+#include "generator.h"
+#include "kernels.h"
+#include "threadpool.h"
+
+using namespace std;
+
+namespace {
+
+// Проверка того, что строка состоит только из цифр
+bool isNumber(const string& str) {
+    if(str.empty())
+        return false;
+    for(auto i : str) {
+        if(!isdigit(i))
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Точность и полнота найденных пикселей относительно внедрённых
+ * \param found - найденные пиксели
+ * \param truth - внедрённые пиксели по возрастанию
+ * \param precision - доля внедрённых среди найденных
+ * \param recall - доля найденных среди внедрённых
+ */
+void score(const DefectMap& found, const vector<size_t>& truth, double& precision, double& recall) {
+    size_t truePositives = 0;
+    for(size_t index : truth) {
+        if(found.contains(index))
+            truePositives++;
+    }
+    const size_t count = found.count();
+    precision = count ? double(truePositives) / count : 1.0;
+    recall = truth.empty() ? 1.0 : double(truePositives) / truth.size();
+}
+
+} // namespace
+
+/*!
+ * \brief Замер скорости и качества методов на синтетическом кадре.
+ * Для каждого метода и для совмещённого прохода всеми методами (в том числе в каскадном режиме) выполняется несколько повторов,
+ * время измеряется по steady_clock и выводится лучшее и медианное вместе с пропускной способностью.
+ */
+int main(int argc, char* argv[])
+{
+    GeneratorSettings settings;
+    uint16 threshold = 0xffff * 0.2;
+    unsigned trials = 5, threads = 0;
+    for(int i = 1; i < argc; i++) {
+        const string option = argv[i];
+        if(i + 1 >= argc) {
+            cout << "Options:\n"
+                    "  --size WxH            frame size (4096x3072 by default)\n"
+                    "  --noise SIGMA         background noise (150 by default)\n"
+                    "  --hot N --dead N      planted hot and dead pixels (200 each by default)\n"
+                    "  --clusters N          planted clusters of hot pixels (50 by default)\n"
+                    "  --threshold PERCENT   detection threshold (20 by default)\n"
+                    "  --trials N            runs per method (5 by default)\n"
+                    "  --threads N           number of threads (all cores by default)\n"
+                    "  --simd LEVEL          scalar, sse41 or avx2 (best available by default)\n"
+                    "  --seed N              generator seed" << endl;
+            return 0;
+        }
+        const string value = argv[++i];
+        const size_t x = value.find('x');
+        if(option == "--size" && x != string::npos && isNumber(value.substr(0, x)) && isNumber(value.substr(x + 1))) {
+            settings.width = stoul(value.substr(0, x));
+            settings.height = stoul(value.substr(x + 1));
+        }
+        else if(option == "--noise")
+            settings.noise = atof(value.c_str());
+        else if(option == "--hot" && isNumber(value))
+            settings.hot = stoul(value);
+        else if(option == "--dead" && isNumber(value))
+            settings.dead = stoul(value);
+        else if(option == "--clusters" && isNumber(value))
+            settings.clusters = stoul(value);
+        else if(option == "--threshold" && isNumber(value) && stoul(value) > 0 && stoul(value) < 100)
+            threshold = 0xffff * (stoul(value) / 100.0);
+        else if(option == "--trials" && isNumber(value) && stoul(value) > 0)
+            trials = stoul(value);
+        else if(option == "--threads" && isNumber(value) && stoul(value) > 0)
+            threads = stoul(value);
+        else if(option == "--simd" && (value == "scalar" || value == "sse41" || value == "avx2"))
+            setSimdLevel(value == "scalar" ? SIMD_SCALAR : value == "sse41" ? SIMD_SSE41 : SIMD_AVX2);
+        else if(option == "--seed" && isNumber(value))
+            settings.seed = stoul(value);
+        else {
+            cout << "Error: bad option " << option << " " << value << endl;
+            return 0;
+        }
+    }
+
+    const SyntheticFrame frame = generateFrame(settings);
+    const size_t npixels = frame.raster.size();
+    vector<uint16> raster = frame.raster;
+    ThreadPool pool(threads);
+    static const char* simdNames[] = {"scalar", "sse41", "avx2"};
+    cout << "Frame " << frame.width << "x" << frame.height << ", planted " << frame.defects.size()
+         << " pixels, threads " << pool.threadCount() << ", simd " << simdNames[simdLevel()] << endl;
+
+    // После отдельных методов и совмещённого прохода замеряются те же проходы в каскадном режиме
+    static const char* names[numberOfMethods + 3] = {"avg3", "avg5", "median3", "hierarchy3", "fused all",
+                                                     "hier3 casc", "fused casc"};
+    static const uint8 passes[numberOfMethods + 3] = {METHOD_AVG3, METHOD_AVG5, METHOD_MEDIAN3, METHOD_HIERARCHY3, METHOD_ALL,
+                                                      METHOD_HIERARCHY3 | SEARCH_CASCADE, METHOD_ALL | SEARCH_CASCADE};
+    cout << left << setw(12) << "method" << right << setw(10) << "best ms" << setw(10) << "median ms"
+         << setw(10) << "MP/s" << setw(8) << "found" << setw(11) << "precision" << setw(8) << "recall" << endl;
+    for(uint8 m = 0; m < numberOfMethods + 3; m++) {
+        const uint8 methods = passes[m];
+        vector<double> times;
+        DefectMap found(npixels);
+        for(unsigned trial = 0; trial < trials; trial++) {
+            DefectMap* brokenPixels[numberOfMethods];
+            const auto start = chrono::steady_clock::now();
+            fusedBrokenPixelSearch(raster.data(), frame.width, npixels, threshold, methods, brokenPixels, &pool);
+            times.push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+
+            found = DefectMap(npixels);
+            for(uint8 i = 0; i < numberOfMethods; i++) {
+                if(brokenPixels[i])
+                    found.unite(*brokenPixels[i]);
+                delete brokenPixels[i];
+            }
+        }
+        sort(times.begin(), times.end());
+        const double median = times[times.size() / 2];
+        double precision, recall;
+        score(found, frame.defects, precision, recall);
+        cout << left << setw(12) << names[m] << right << fixed << setprecision(2)
+             << setw(10) << times.front() << setw(10) << median << setw(10) << npixels / 1000.0 / median
+             << setw(8) << found.count() << setprecision(3) << setw(11) << precision << setw(8) << recall << endl;
+    }
+    return 0;
+}
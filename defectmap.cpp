@@ -0,0 +1,222 @@
+#include "defectmap.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+using namespace std;
+
+const char defectMapMagic[4] = {'B', 'P', 'D', 'M'};
+const uint32 defectMapVersion = 1;
+
+namespace {
+
+/*!
+ * \brief Чтение карты из файла формата map (заголовок DefectMapFileHeader прочитан)
+ * \return В случае успеха вернёт true, иначе false (карта другого изображения, файл обрезан или повреждён)
+ */
+bool readMapFile(ifstream& file, const DefectMapFileHeader& header, uint32 w, uint32 h,
+                 vector<uint32>& indices, vector<uint64>& bits) {
+    const size_t npixels = size_t(w) * h;
+    if(header.version != defectMapVersion || header.width != w || header.height != h)
+        return false;
+    if(header.representation == DefectMap::Indices) {
+        if(header.count > npixels)
+            return false;
+        indices.resize(size_t(header.count));
+        if(!file.read(reinterpret_cast<char*>(indices.data()), streamsize(indices.size() * sizeof(uint32))))
+            return false;
+        // Индексы должны строго возрастать и лежать в пределах изображения
+        for(size_t i = 0; i < indices.size(); i++) {
+            if(indices[i] >= npixels || (i > 0 && indices[i] <= indices[i - 1]))
+                return false;
+        }
+        return true;
+    }
+    if(header.representation != DefectMap::Bitmap || header.count != (npixels + 63) / 64)
+        return false;
+    bits.resize(size_t(header.count));
+    if(!file.read(reinterpret_cast<char*>(bits.data()), streamsize(bits.size() * sizeof(uint64))))
+        return false;
+    // Биты за последним пикселем должны быть нулевыми
+    return npixels % 64 == 0 || (bits.back() >> (npixels % 64)) == 0;
+}
+
+} // namespace
+
+/*!
+ * \brief Пустой набор для области изображения
+ * \param npixels - количество пикселей в области
+ * \param offset - индекс первого пикселя области
+ */
+DefectMap::DefectMap(size_t npixels, size_t offset) : npixels(npixels), firstIndex(offset), repr(Indices) {
+    if(!fitsIndices())
+        toBitmap();
+}
+
+/*!
+ * \brief Добавление индекса пикселя.
+ * Индексы, добавляемые по возрастанию, дописываются в конец массива.
+ * \param index - индекс пикселя
+ */
+void DefectMap::insert(size_t index) {
+    if(repr == Indices) {
+        if(sortedIndices.empty() || index > sortedIndices.back()) {
+            sortedIndices.push_back(uint32(index));
+            // Битовая карта занимает npixels/8 байт, массив - 4 байта на индекс
+            if(sortedIndices.size() > npixels / 32)
+                toBitmap();
+            return;
+        }
+        if(index == sortedIndices.back())
+            return;
+        toBitmap();
+    }
+    index -= firstIndex;
+    bits[index / 64] |= uint64(1) << (index % 64);
+}
+
+// Проверка наличия индекса
+bool DefectMap::contains(size_t index) const {
+    if(repr == Indices)
+        return binary_search(sortedIndices.begin(), sortedIndices.end(), uint32(index));
+    index -= firstIndex;
+    return (bits[index / 64] >> (index % 64)) & 1;
+}
+
+// Количество индексов в наборе
+size_t DefectMap::count() const {
+    if(repr == Indices)
+        return sortedIndices.size();
+    size_t total = 0;
+    for(uint64 word : bits)
+        total += popcount64(word);
+    return total;
+}
+
+/*!
+ * \brief Объединение с другим набором того же изображения.
+ * Область other должна лежать внутри области этого набора.
+ * \param other - добавляемый набор
+ * \return Ссылка на этот набор
+ */
+DefectMap& DefectMap::unite(const DefectMap& other) {
+    if(repr == Indices && other.repr == Indices) {
+        // Наборы соседних полос дописываются в конец без слияния
+        if(sortedIndices.empty() || other.sortedIndices.empty() || other.sortedIndices.front() > sortedIndices.back()) {
+            sortedIndices.insert(sortedIndices.end(), other.sortedIndices.begin(), other.sortedIndices.end());
+            if(sortedIndices.size() > npixels / 32)
+                toBitmap();
+            return *this;
+        }
+        vector<uint32> merged;
+        merged.reserve(sortedIndices.size() + other.sortedIndices.size());
+        set_union(sortedIndices.begin(), sortedIndices.end(), other.sortedIndices.begin(), other.sortedIndices.end(),
+                  back_inserter(merged));
+        sortedIndices.swap(merged);
+        if(sortedIndices.size() > npixels / 32)
+            toBitmap();
+        return *this;
+    }
+    toBitmap();
+    if(other.repr == Bitmap && other.firstIndex == firstIndex && other.bits.size() == bits.size()) {
+        for(size_t i = 0; i < bits.size(); i++)
+            bits[i] |= other.bits[i];
+    } else {
+        other.forEach([this](size_t index) {
+            index -= firstIndex;
+            bits[index / 64] |= uint64(1) << (index % 64);
+        });
+    }
+    return *this;
+}
+
+// Перевод в представление битовой картой
+void DefectMap::toBitmap() {
+    if(repr == Bitmap)
+        return;
+    bits.assign((npixels + 63) / 64, 0);
+    for(uint32 index : sortedIndices)
+        bits[(index - firstIndex) / 64] |= uint64(1) << ((index - firstIndex) % 64);
+    vector<uint32>().swap(sortedIndices);
+    repr = Bitmap;
+}
+
+// Перевод в представление отсортированным массивом индексов (если индексы помещаются в 32 бита)
+void DefectMap::toIndices() {
+    if(repr == Indices || !fitsIndices())
+        return;
+    vector<uint32> indices;
+    indices.reserve(count());
+    forEach([&indices](size_t index) { indices.push_back(uint32(index)); });
+    sortedIndices.swap(indices);
+    vector<uint64>().swap(bits);
+    repr = Indices;
+}
+
+/*!
+ * \brief Чтение списка пикселей из текстового файла или файла карты формата map.
+ * Строка вида "x y", "x;y" или "(x;y)" задаёт пиксель, поэтому подходит и таблица, которую выводит программа;
+ * строки, не начинающиеся с координат (заголовки, итоги), пропускаются.
+ * Файл карты (начинается с DefectMapFileHeader) читается в представление, в котором был записан, без разбора текста.
+ * \param path - путь к файлу
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param out - набор пикселей изображения
+ * \return В случае успеха вернёт true, иначе false (не удалось открыть файл, пиксель за пределами изображения
+ * или карта другого изображения)
+ */
+bool readDefectList(const string& path, uint32 w, uint32 h, DefectMap& out) {
+    ifstream list(path, ios::binary);
+    if(!list)
+        return false;
+    DefectMapFileHeader header;
+    if(list.read(reinterpret_cast<char*>(&header), sizeof(header)) && memcmp(header.magic, defectMapMagic, sizeof(defectMapMagic)) == 0) {
+        out = DefectMap(size_t(w) * h);
+        if(!readMapFile(list, header, w, h, out.sortedIndices, out.bits))
+            return false;
+        if(header.representation == DefectMap::Bitmap) {
+            vector<uint32>().swap(out.sortedIndices);
+            out.repr = DefectMap::Bitmap;
+        }
+        else if(out.repr == DefectMap::Bitmap) {
+            // Изображение больше 2^32 пикселей хранится только битовой картой
+            return false;
+        }
+        return true;
+    }
+    list.clear();
+    list.seekg(0);
+    vector<size_t> indices;
+    string line;
+    while(getline(list, line)) {
+        const char* p = line.c_str();
+        while(*p == ' ' || *p == '\t')
+            p++;
+        if(*p == '(')
+            p++;
+        if(!isdigit(uint8(*p)))
+            continue;
+        char* end;
+        const unsigned long long x = strtoull(p, &end, 10);
+        p = end;
+        if(*p != ' ' && *p != '\t' && *p != ';' && *p != ',')
+            continue;
+        while(*p == ' ' || *p == '\t' || *p == ';' || *p == ',')
+            p++;
+        if(!isdigit(uint8(*p)))
+            continue;
+        const unsigned long long y = strtoull(p, &end, 10);
+        if(x >= w || y >= h)
+            return false;
+        indices.push_back(size_t(y) * w + size_t(x));
+    }
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+    out = DefectMap(size_t(w) * h);
+    for(size_t index : indices)
+        out.insert(index);
+    return true;
+}
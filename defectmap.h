@@ -0,0 +1,192 @@
+#ifndef DEFECTMAP_H
+#define DEFECTMAP_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tiffio.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Количество установленных битов
+inline uint32 popcount64(uint64 word) {
+#if defined(_MSC_VER)
+    return uint32(__popcnt64(word));
+#else
+    return uint32(__builtin_popcountll(word));
+#endif
+}
+
+// Номер младшего установленного бита (word != 0)
+inline uint32 lowestBit64(uint64 word) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+#else
+    return uint32(__builtin_ctzll(word));
+#endif
+}
+
+/*!
+ * \brief Набор индексов битых пикселей изображения.
+ * Хранится либо отсортированным массивом 32-битных индексов, пока пикселей мало, либо битовой картой
+ * по биту на пиксель. Представление меняется на битовую карту автоматически, когда массив индексов
+ * становится больше неё или индексы добавляются не по возрастанию.
+ * Объединение битовых карт выполняется побитовым ИЛИ, подсчёт - через popcount.
+ * Набор может охватывать часть изображения [offset, offset + npixels) - например, полосу строк,
+ * обработанную одним потоком. Индексы всегда хранятся и возвращаются относительно начала изображения.
+ * Если индексы области не помещаются в 32 бита (изображения больше 2^32 пикселей), набор всегда хранится битовой картой.
+ */
+class DefectMap {
+public:
+    enum Representation : uint8 {
+        Indices, // Отсортированный массив индексов
+        Bitmap   // Бит на пиксель
+    };
+
+    explicit DefectMap(size_t npixels = 0, size_t offset = 0);
+
+    size_t pixels() const { return npixels; }
+    size_t offset() const { return firstIndex; }
+    Representation representation() const { return repr; }
+
+    void insert(size_t index);
+    bool contains(size_t index) const;
+    size_t count() const;
+    bool isEmpty() const { return count() == 0; }
+    DefectMap& unite(const DefectMap& other);
+
+    void toBitmap();
+    void toIndices();
+
+    // Слова битовой карты (только для представления Bitmap)
+    const std::vector<uint64>& words() const { return bits; }
+    // Индексы (только для представления Indices)
+    const std::vector<uint32>& indices() const { return sortedIndices; }
+
+    /*!
+     * \brief Обход индексов по возрастанию
+     * \param callback - функция, вызываемая для каждого индекса
+     */
+    template<typename F>
+    void forEach(F callback) const {
+        if(repr == Indices) {
+            for(uint32 index : sortedIndices)
+                callback(size_t(index));
+            return;
+        }
+        for(size_t i = 0; i < bits.size(); i++) {
+            for(uint64 word = bits[i]; word != 0; word &= word - 1)
+                callback(firstIndex + i * 64 + lowestBit64(word));
+        }
+    }
+
+    /*!
+     * \brief Линейный обход объединения нескольких карт с маской карт, содержащих каждый индекс.
+     * Все карты должны охватывать одну область, отсутствующие карты равны nullptr.
+     * Массивы индексов обходятся слиянием, поэтому редкие дефекты не требуют битовой карты размером с изображение.
+     * Если хотя бы одна карта - битовая, остальные переводятся в битовые карты во временных копиях.
+     * \param maps - массив карт (не больше 32)
+     * \param count - количество карт
+     * \param callback - функция, вызываемая для каждого индекса с маской карт (бит i - карта maps[i])
+     */
+    template<typename F>
+    static void forEachUnion(const DefectMap* const maps[], uint8 count, F callback) {
+        bool allIndices = true;
+        for(uint8 m = 0; m < count; m++) {
+            if(maps[m] && maps[m]->repr != Indices)
+                allIndices = false;
+        }
+        if(allIndices) {
+            std::vector<size_t> pos(count, 0);
+            while(true) {
+                // Наименьший ещё не пройденный индекс среди всех карт
+                size_t index = SIZE_MAX;
+                for(uint8 m = 0; m < count; m++) {
+                    if(maps[m] && pos[m] < maps[m]->sortedIndices.size() && maps[m]->sortedIndices[pos[m]] < index)
+                        index = maps[m]->sortedIndices[pos[m]];
+                }
+                if(index == SIZE_MAX)
+                    return;
+                uint32 mask = 0;
+                for(uint8 m = 0; m < count; m++) {
+                    if(maps[m] && pos[m] < maps[m]->sortedIndices.size() && maps[m]->sortedIndices[pos[m]] == index) {
+                        mask |= uint32(1) << m;
+                        pos[m]++;
+                    }
+                }
+                callback(index, mask);
+            }
+        }
+
+        // Карты в представлении Indices заменяются битовыми копиями
+        std::vector<DefectMap> converted;
+        converted.reserve(count);
+        std::vector<const DefectMap*> bitmaps(maps, maps + count);
+        size_t nwords = 0, firstIndex = 0;
+        for(uint8 m = 0; m < count; m++) {
+            if(!maps[m])
+                continue;
+            if(maps[m]->repr == Indices) {
+                converted.push_back(*maps[m]);
+                converted.back().toBitmap();
+                bitmaps[m] = &converted.back();
+            }
+            nwords = bitmaps[m]->bits.size();
+            firstIndex = bitmaps[m]->firstIndex;
+        }
+        for(size_t i = 0; i < nwords; i++) {
+            uint64 any = 0;
+            for(uint8 m = 0; m < count; m++) {
+                if(bitmaps[m])
+                    any |= bitmaps[m]->bits[i];
+            }
+            for(; any != 0; any &= any - 1) {
+                const uint32 bit = lowestBit64(any);
+                uint32 mask = 0;
+                for(uint8 m = 0; m < count; m++) {
+                    if(bitmaps[m])
+                        mask |= uint32((bitmaps[m]->bits[i] >> bit) & 1) << m;
+                }
+                callback(firstIndex + i * 64 + bit, mask);
+            }
+        }
+    }
+
+private:
+    friend bool readDefectList(const std::string& path, uint32 w, uint32 h, DefectMap& out);
+
+    // Индексы области помещаются в массив 32-битных индексов
+    bool fitsIndices() const { return firstIndex + npixels <= size_t(UINT32_MAX) + 1; }
+
+    size_t npixels;
+    size_t firstIndex;
+    Representation repr;
+    std::vector<uint32> sortedIndices;
+    std::vector<uint64> bits;
+};
+
+/*!
+ * \brief Заголовок файла карты битых пикселей (формат вывода map).
+ * За ним следует count элементов представления карты: отсортированные индексы (uint32)
+ * или слова битовой карты (uint64) по всему изображению; числа - в порядке байтов процессора.
+ * Файл читается в DefectMap без разбора текста (см. readDefectList).
+ */
+struct DefectMapFileHeader {
+    char magic[4]; // "BPDM"
+    uint32 version;
+    uint32 width;
+    uint32 height;
+    uint32 representation; // DefectMap::Representation
+    uint32 reserved;
+    uint64 count; // Количество индексов или слов
+};
+
+extern const char defectMapMagic[4];
+extern const uint32 defectMapVersion;
+
+bool readDefectList(const std::string& path, uint32 w, uint32 h, DefectMap& out);
+
+#endif // DEFECTMAP_H
@@ -0,0 +1,1048 @@
+#include "detectors.h"
+#include "kernels.h"
+#include "metrics.h"
+#include "stencil.h"
+#include "threadpool.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+using namespace std;
+
+/*!
+ * \brief Проверка того, что разница пикселей превысит заданный порог
+ * \param delta - разница значений цветов пикселей
+ * \param threshold - пороговое значение
+ * \return Если порог превышен, то возвращает true, иначе false
+ */
+bool isExceedThreshold(int32 delta, const uint16 threshold) {
+    if(delta >= 0 && delta > threshold) {
+        return true;
+    } else if(delta < 0 && delta < -threshold) {
+        return true;
+    }
+    return false;
+}
+
+// Поиск медианы (без ветвлений, зависящих от данных)
+uint16 median(uint16 f, uint16 s, uint16 t) {
+    return max(min(f, s), min(max(f, s), t));
+}
+
+namespace {
+
+/*!
+ * \brief Высота полосы строк, обрабатываемой за один проход всеми методами.
+ * Полоса растра вместе со скользящими суммами среднего 5*5 должна помещаться в кэш L2
+ * (с запасом на пиксель растра, сумму и 1 байт количества совпадающих соседей на пиксель).
+ * \param w - ширина изображения
+ * \return Количество строк в полосе
+ */
+template<typename Pixel>
+size_t bandHeight(uint32 w) {
+    const size_t cacheBytes = 256 * 1024;
+    const size_t pixelBytes = sizeof(Pixel) + sizeof(typename PixelTraits<Pixel>::Sum) + 1;
+    return clamp(cacheBytes / (size_t(w) * pixelBytes), size_t(8), size_t(256));
+}
+
+// Доля кандидатов в строке (1/cascadeDenseShare ширины), начиная с которой каскад проверяет строку целиком
+const uint32 cascadeDenseShare = 32;
+
+/* Рабочая память построчного прохода, закреплённая за потоком, не меньше bytes байт.
+ * Буфер живёт до завершения потока и растёт только при увеличении ширины изображения, поэтому потоки пула
+ * обрабатывают кадры одного размера без выделения памяти. fusedRows не запускает задачи пула,
+ * так что буфер потока не используется двумя проходами одновременно.
+ */
+uint8* threadScratch(size_t bytes) {
+    thread_local vector<uint64> buffer; // Элементы uint64 выравнивают буфер для сумм любого типа
+    if(buffer.size() * sizeof(uint64) < bytes)
+        buffer.resize((bytes + sizeof(uint64) - 1) / sizeof(uint64));
+    return reinterpret_cast<uint8*>(buffer.data());
+}
+
+// Размер части рабочей памяти, выровненный по строке кэша
+constexpr size_t scratchPart(size_t bytes) {
+    return (bytes + 63) / 64 * 64;
+}
+
+/* Построчные ядра для типа пикселя. Для 16-битных пикселей выбираются векторные ядра
+ * текущего набора инструкций (rowKernels), для остальных типов - шаблоны stencil.h,
+ * которые встраиваются в детекторы и специализируются под тип и размер окна при компиляции.
+ */
+template<typename Pixel>
+struct StencilKernels {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    typedef typename PixelTraits<Pixel>::Threshold Threshold;
+
+    static void neighborSums(const Pixel* r0, const Pixel* r1, const Pixel* r2, uint32 x0, uint32 x1, Sum* sums, uint8* same) {
+        stencil::neighborSums(r0, r1, r2, x0, x1, sums, same);
+    }
+    static uint32 avg3Row(const Pixel* row, const Sum* sums, uint32 x0, uint32 x1, const Threshold threshold, uint32* hits) {
+        return stencil::avg3Row(row, sums, x0, x1, threshold, hits);
+    }
+    static void shiftColumnSums(Sum* colSums, const Pixel* added, const Pixel* removed, uint32 x0, uint32 x1) {
+        stencil::shiftColumnSums(colSums, added, removed, x0, x1);
+    }
+    template<uint32 K>
+    static uint32 avgBoxRow(const Pixel* row, const Sum* boxSums, uint32 x0, uint32 x1, uint32 adjSize,
+                            const Threshold threshold, uint32* hits) {
+        return stencil::avgBoxRow<K>(row, boxSums, x0, x1, adjSize, threshold, hits);
+    }
+    static uint32 median3Row(const Pixel* r0, const Pixel* r1, const Pixel* r2, uint32 x0, uint32 x1,
+                             const Threshold threshold, uint32* hits) {
+        return stencil::median3Row(r0, r1, r2, x0, x1, threshold, hits);
+    }
+
+    static uint32 deviationRow(const Pixel* r0, const Pixel* r1, const Pixel* r2, uint32 x0, uint32 x1,
+                               const Threshold threshold, uint32* hits) {
+        return stencil::deviationRow(r0, r1, r2, x0, x1, threshold, hits);
+    }
+};
+
+template<>
+struct StencilKernels<uint16> {
+    static void neighborSums(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, uint32* sums, uint8* same) {
+        rowKernels().neighborSums(r0, r1, r2, x0, x1, sums, same);
+    }
+    static uint32 avg3Row(const uint16* row, const uint32* sums, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+        return rowKernels().avg3Row(row, sums, x0, x1, threshold, hits);
+    }
+    static void shiftColumnSums(uint32* colSums, const uint16* added, const uint16* removed, uint32 x0, uint32 x1) {
+        rowKernels().shiftColumnSums(colSums, added, removed, x0, x1);
+    }
+    template<uint32 K>
+    static uint32 avgBoxRow(const uint16* row, const uint32* boxSums, uint32 x0, uint32 x1, uint32 adjSize,
+                            const uint16 threshold, uint32* hits) {
+        return rowKernels().avgBoxRow(row, boxSums, x0, x1, adjSize, threshold, hits);
+    }
+    static uint32 median3Row(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1,
+                             const uint16 threshold, uint32* hits) {
+        return rowKernels().median3Row(r0, r1, r2, x0, x1, threshold, hits);
+    }
+
+    static uint32 deviationRow(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1,
+                               const uint16 threshold, uint32* hits) {
+        return rowKernels().deviationRow(r0, r1, r2, x0, x1, threshold, hits);
+    }
+};
+
+/*!
+ * \brief Вычисление сумм 8 соседей и количества соседей того же цвета для строк [first, last).
+ * Для пикселей крайних строк и столбцов значения нулевые.
+ * \param rows - строки растра
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param first - первая строка
+ * \param last - строка, следующая за последней
+ * \param sums - суммы соседей, строка first записывается в начало массива
+ * \param same - количество соседей того же цвета (nullptr, если не требуется)
+ */
+template<typename Pixel>
+void precomputeNeighbors(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, size_t first, size_t last,
+                         typename PixelTraits<Pixel>::Sum* sums, uint8* same) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    for(size_t y = first; y < last; y++) {
+        Sum* s = sums + (y - first) * w;
+        uint8* m = same ? same + (y - first) * w : nullptr;
+        if(y == 0 || y == h - 1) {
+            fill(s, s + w, 0);
+            if(m)
+                fill(m, m + w, 0);
+            continue;
+        }
+        s[0] = s[w - 1] = 0;
+        if(m)
+            m[0] = m[w - 1] = 0;
+        StencilKernels<Pixel>::neighborSums(rows.row(y - 1), rows.row(y), rows.row(y + 1), 1, w - 1, s, m);
+    }
+}
+
+// Перенос номеров столбцов, отобранных ядром, в набор индексов
+void insertHits(const uint32* hits, uint32 count, size_t rowOffset, DefectMap* out) {
+    for(uint32 i = 0; i < count; i++)
+        out->insert(rowOffset + hits[i]);
+}
+
+// Проверка строки y методом среднего значения в квадрате 3*3 по заранее посчитанным суммам соседей
+template<typename Pixel>
+void avg3Row(const Pixel* row, const typename PixelTraits<Pixel>::Sum* sums, uint32 w, size_t rowOffset,
+             const typename PixelTraits<Pixel>::Threshold threshold, uint32* hits, DefectMap* out) {
+    insertHits(hits, StencilKernels<Pixel>::avg3Row(row, sums, 1, w - 1, threshold, hits), rowOffset, out);
+}
+
+/*!
+ * \brief Проверка строк [y0, y1) методом среднего значения в квадрате k*k на скользящих суммах.
+ * Для каждого столбца хранится сумма k пикселей по вертикали, которая при переходе к следующей строке
+ * обновляется добавлением нижнего и вычитанием верхнего пикселя. Сумма квадрата получается скольжением
+ * окна из k столбцовых сумм вдоль строки. Таким образом на пиксель приходится постоянное число операций
+ * независимо от k (кроме заполнения сумм для первой строки диапазона).
+ * Размер квадрата K задаётся при компиляции, чтобы деление на количество пикселей заменялось умножением;
+ * при K = 0 используется размер k, заданный во время работы.
+ * \param rows - строки растра
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param k - размер квадрата (нечётный), если K = 0
+ * \param y0 - первая проверяемая строка
+ * \param y1 - строка, следующая за последней проверяемой
+ * \param colSums - массив размером 2*w: столбцовые суммы и суммы квадратов строки
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param hits - массив размером w для номеров отобранных столбцов строки
+ * \param out - набор индексов отобранных пикселей
+ */
+template<uint32 K, typename Pixel>
+void avgBoxRows(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, uint8 k, size_t y0, size_t y1,
+                typename PixelTraits<Pixel>::Sum* colSums, const typename PixelTraits<Pixel>::Threshold threshold,
+                uint32* hits, DefectMap* out) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    typedef StencilKernels<Pixel> Kernels;
+    if(K)
+        k = K;
+    const uint32 r = k / 2;
+    const uint32 adjSize = uint32(k) * k - 1; // Количество пикселей в квадрате без центрального
+    y0 = max(y0, size_t(r));
+    y1 = min(y1, size_t(h - r));
+    if(w < k || y0 >= y1)
+        return;
+
+    Sum* boxSums = colSums + w;
+    fill(colSums, colSums + w, Sum(0));
+    for(size_t y = y0 - r; y <= y0 + r; y++) {
+        const Pixel* row = rows.row(y);
+        for(uint32 x = 0; x < w; x++)
+            colSums[x] += row[x];
+    }
+
+    for(size_t y = y0; y < y1; y++) {
+        if(y > y0) // Сдвиг окна столбцовых сумм на одну строку вниз
+            Kernels::shiftColumnSums(colSums, rows.row(y + r), rows.row(y - r - 1), 0, w);
+        Sum sum = 0;
+        for(uint32 x = 0; x < k; x++)
+            sum += colSums[x];
+        boxSums[r] = sum;
+        for(uint32 x = r + 1; x < w - r; x++) {
+            sum += colSums[x + r] - colSums[x - r - 1];
+            boxSums[x] = sum;
+        }
+        // Если отличие среднего без центрального пикселя превышает заданный порог, то индекс пикселя добавляется в набор
+        const uint32 count = Kernels::template avgBoxRow<K>(rows.row(y), boxSums, r, w - r, adjSize, threshold, hits);
+        insertHits(hits, count, y * w, out);
+    }
+}
+
+/* Проверка строки методом медианы в квадрате 3*3.
+ * rows - строки y-1..y+1
+ * Пары диаметрально противоположных пикселей (число - номер пары, p - центральный пиксель,
+ * является третьим элементом вместе с парой при поиске медианы):
+ * 3 1 2
+ * 0 p 0
+ * 2 1 3
+ */
+template<typename Pixel>
+void median3Row(const Pixel* const rows[3], uint32 w, size_t rowOffset, const typename PixelTraits<Pixel>::Threshold threshold,
+                uint32* hits, DefectMap* out) {
+    insertHits(hits, StencilKernels<Pixel>::median3Row(rows[0], rows[1], rows[2], 1, w - 1, threshold, hits), rowOffset, out);
+}
+
+/* Выбор соседа методом иерархий в исходной постановке: веса в double и max_element.
+ * Используется, когда целочисленного сравнения недостаточно, чтобы повторить его выбор (см. hierarchyDirection),
+ * и для вещественных пикселей.
+ * sumsMinusPixel - суммы соседей каждого соседа без проверяемого пикселя (для целых пикселей в uint32, как в исходном алгоритме),
+ * V - количество соседей того же цвета, diffs - разницы противолежащих пикселей, M - мзц.
+ */
+template<typename Sum>
+uint8 hierarchyDirectionDouble(const Sum sumsMinusPixel[8], const uint8 V[8], const Sum diffs[4], const double M) {
+    double avgNeighborPixel[8]; // Средние значения окружающих пикселей, исключая проверяемый, для 8 пикселей соседей
+    double sumAvgNeighborPixels = M * 7; // Сумма отличий средних значений соседних пикселей от мзц
+    double samePixelsSum = 0; // Сумма значений для соседних пикселей из массива same
+    double sumDiffs = M * 4; // Сумма разниц
+    double P[8]; // Веса пикселей (общий, по критерию 1)
+    for(uint8 dir = 0; dir < 8; dir++) {
+        avgNeighborPixel[dir] = sumsMinusPixel[dir] / 7.0;
+        sumAvgNeighborPixels -= avgNeighborPixel[dir];
+        if(V[dir] != 0)
+            samePixelsSum += V[dir];
+        if(dir < 4)
+            sumDiffs -= diffs[dir];
+    }
+    // Получаем сумму для 8 соседей
+    sumDiffs *= 2;
+    // Расчитываем веса
+    fill(P, P + 8, 0.0);
+    for(uint8 dir = 0; dir < 8; dir++) {
+        // Вес по критерию 1
+        P[dir] += (M - avgNeighborPixel[dir]) / sumAvgNeighborPixels;
+        // Вес по критерию 2
+        if(V[dir] != 0)
+            P[dir] += V[dir] / samePixelsSum;
+        // Вес по критерию 3
+        if(dir < 4) {
+            const double W = (M - diffs[dir]) / sumDiffs;
+            P[dir] += W;
+            // Т.к значения весов одинаковы для пикселей в паре, добавляем такой же вес противоположному пикселю
+            P[7 - dir] += W;
+        }
+    }
+    return uint8(max_element(P, P + 8) - P);
+}
+
+/* Выбор соседа методом иерархий.
+ * A - суммы соседей каждого соседа без проверяемого пикселя, V - количество соседей того же цвета,
+ * diffs - разницы противолежащих пикселей, exceedMask - бит dir установлен, если отличие от соседа dir превышает порог.
+ *
+ * Веса трёх критериев - дроби с общими для всех соседей знаменателями:
+ *   P[d] = (7M - A[d]) / SA + V[d] / Vsum + (M - diff[d]) / D,
+ * где A[d] = sums[d] - c, SA = 49M - сумма A, Vsum - сумма V, D = 2(4M - сумма diff).
+ * Для целых пикселей, умножив на SA*Vsum*D, получаем целые числители, которые сравниваются без делений
+ * (с учётом знака знаменателя; все значения меньше 2^59 и помещаются в int64).
+ * Исходный алгоритм считает веса в double, и при почти равных весах округление может выбрать
+ * другого соседа. Поэтому если соседи с почти равным весом дают разный ответ на проверку порога
+ * (или знаменатель вырожден), выбор повторяется в double - результат совпадает с исходным.
+ * Вещественные пиксели сразу выбираются в double.
+ */
+template<typename Pixel>
+uint8 hierarchyDirection(const typename PixelTraits<Pixel>::Sum A[8], const uint8 V[8],
+                         const typename PixelTraits<Pixel>::Sum diffs[4], uint32 exceedMask) {
+    const double maxValue = PixelTraits<Pixel>::maxValue;
+    if constexpr(is_integral<Pixel>::value) {
+        // Константы мзц для одного значения, 7 (при вычислении сумм средних), 4 (при вычислении суммы разниц)
+        const int64 M = PixelTraits<Pixel>::maxValue, avgM = M*7, diffM = M*4;
+        int64 sumA = 0, sumV = 0, sumDiffs = 0;
+        for(uint8 dir = 0; dir < 8; dir++) {
+            sumA += A[dir];
+            sumV += V[dir];
+        }
+        for(uint8 dir = 0; dir < 4; dir++)
+            sumDiffs += diffs[dir];
+
+        const int64 SA = 7 * avgM - sumA;
+        const int64 D = 2 * (diffM - sumDiffs);
+        const int64 Vs = sumV != 0 ? sumV : 1; // Без совпадающих соседей критерий 2 равен нулю
+        if(SA == 0 || D == 0)
+            return hierarchyDirectionDouble(A, V, diffs, maxValue);
+
+        // Слагаемые 7M*K1 и M*K3 одинаковы для всех соседей и в сравнении не участвуют
+        const int64 sign = SA > 0 ? 1 : -1;
+        const int64 K1 = sign * Vs * D, K2 = sign * SA * D, K3 = sign * SA * Vs;
+        int64 N[8];
+        int64 bestN = INT64_MIN;
+        uint8 best = 0;
+        uint32 maxA = 0;
+        for(uint8 dir = 0; dir < 8; dir++) {
+            const uint8 pair = dir < 4 ? dir : 7 - dir;
+            N[dir] = V[dir] * K2 - A[dir] * K1 - diffs[pair] * K3;
+            best = N[dir] > bestN ? dir : best;
+            bestN = max(bestN, N[dir]);
+            maxA = max(maxA, A[dir]);
+        }
+        // Наименьший отрыв от соседа с другим ответом на проверку порога
+        const uint32 exceed = (exceedMask >> best) & 1;
+        int64 gap = INT64_MAX;
+        for(uint8 dir = 0; dir < 8; dir++) {
+            if(((exceedMask >> dir) & 1) != exceed)
+                gap = min(gap, bestN - N[dir]);
+        }
+        /* Погрешность весов double, приведённая к масштабу числителей, с большим запасом:
+         * 2^-40 от суммы модулей слагаемых, причём слагаемое критерия 1 усиливается потерей точности
+         * при вычитании в сумме средних (в (49M + сумма A) / |SA| раз). Всё домножено на |SA|, чтобы не делить.
+         * Если отрыв меньше погрешности, выбор повторяется в double.
+         */
+        const double absSA = double(SA > 0 ? SA : -SA);
+        const double spread = 49.0 * M + double(sumA);
+        const double avgTerm = (double(avgM) + maxA) * double(Vs * D) * (absSA + spread);
+        const double otherTerms = absSA * absSA * (8.0 * D + double(M) * Vs);
+        if(spread < 0x1p30 * absSA && double(gap) * absSA > 0x1p-39 * (avgTerm + otherTerms))
+            return best;
+    }
+    return hierarchyDirectionDouble(A, V, diffs, maxValue);
+}
+
+// Бит dir установлен, если отличие пикселя от соседа dir превышает порог
+template<typename Pixel>
+uint32 neighborExceedMask(const Pixel cPixel, const Pixel neighbor[8], const typename PixelTraits<Pixel>::Threshold threshold) {
+    typedef typename PixelTraits<Pixel>::Value Value;
+    uint32 exceedMask = 0;
+    for(uint8 dir = 0; dir < 8; dir++)
+        exceedMask |= uint32(stencil::exceeds(Value(cPixel) - Value(neighbor[dir]), threshold)) << dir;
+    return exceedMask;
+}
+
+/* Проверка пикселя методом иерархий, когда соседи дают разный ответ на проверку порога (exceedMask не 0 и не 0xff).
+ * neighbor - значения 8 соседей, windowSums и windowSame - суммы соседей каждого соседа и количество его соседей того же цвета.
+ */
+template<typename Pixel>
+bool hierarchyPixel(const Pixel cPixel, const Pixel neighbor[8], const typename PixelTraits<Pixel>::Sum windowSums[8],
+                    const uint8 windowSame[8], uint32 exceedMask) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    Sum A[8]; // Суммы соседей каждого соседа без проверяемого пикселя
+    uint8 V[8]; // Количество пикселей того же цвета (по критерию 2)
+    Sum diffs[4]; // Разница противолежащих пикселей
+    for(uint8 dir = 0; dir < 8; dir++) {
+        // Как и в исходном алгоритме, для целых пикселей вычитание выполняется в uint32 (у крайних пикселей сумма нулевая)
+        A[dir] = windowSums[dir] - cPixel;
+        // Если значение проверяемого пикселя учлось, то исключаем его из общего количества
+        V[dir] = uint8(windowSame[dir] - ((windowSame[dir] != 0) & (cPixel == neighbor[dir])));
+    }
+    for(uint8 dir = 0; dir < 4; dir++) {
+        diffs[dir] = neighbor[dir] > neighbor[7 - dir] ? Sum(neighbor[dir]) - Sum(neighbor[7 - dir])
+                                                       : Sum(neighbor[7 - dir]) - Sum(neighbor[dir]);
+    }
+    return (exceedMask >> hierarchyDirection<Pixel>(A, V, diffs, exceedMask)) & 1;
+}
+
+/* Проверка строки методом иерархий.
+ * rows, sums, same - строки y-1..y+1 растра, сумм соседей и количества соседей того же цвета.
+ * Описание алгоритма приведено у hierarchyBrokenPixelSearch, выбор соседа - у hierarchyDirection.
+ */
+template<typename Pixel>
+void hierarchy3Row(const Pixel* const rows[3], const typename PixelTraits<Pixel>::Sum* const sums[3], const uint8* const same[3],
+                   uint32 w, size_t rowOffset, const typename PixelTraits<Pixel>::Threshold threshold, DefectMap* out) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    for(uint32 x = 1; x < w - 1; x++) {
+        const Pixel cPixel = rows[1][x];
+        // Окрестность загружается явно, чтобы компилятор держал её в регистрах
+        Pixel neighbor[8];
+        stencil::loadNeighbors(rows, x, neighbor, stencil::Neighbors());
+        const uint32 exceedMask = neighborExceedMask(cPixel, neighbor, threshold);
+        // Результат зависит от выбранного соседа, только если соседи дают разный ответ на проверку порога
+        if(exceedMask == 0)
+            continue;
+        if(exceedMask == 0xff) {
+            out->insert(rowOffset + x);
+            continue;
+        }
+
+        Sum windowSums[8];
+        uint8 windowSame[8];
+        stencil::loadNeighbors(sums, x, windowSums, stencil::Neighbors());
+        stencil::loadNeighbors(same, x, windowSame, stencil::Neighbors());
+        // Если отличие превышает заданный порог, то индекс пикселя добавляется в набор
+        if(hierarchyPixel(cPixel, neighbor, windowSums, windowSame, exceedMask))
+            out->insert(rowOffset + x);
+    }
+}
+
+/* Проверка пикселя (x, y) методом иерархий прямо по растру (без кольцевого буфера).
+ * Суммы соседей и количество соседей того же цвета считаются по окрестности 5*5 (строки y-2..y+2) и только
+ * для соседей пикселя; для пикселей на краях изображения они нулевые, как и у precomputeNeighbors,
+ * поэтому результат совпадает с hierarchy3Row. Пиксель не должен лежать на краю изображения.
+ */
+template<typename Pixel>
+bool hierarchyAt(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, size_t y, uint32 x,
+                 const typename PixelTraits<Pixel>::Threshold threshold) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    const Pixel* const rows3[3] = {rows.row(y - 1), rows.row(y), rows.row(y + 1)};
+    const Pixel cPixel = rows3[1][x];
+    Pixel neighbor[8];
+    stencil::loadNeighbors(rows3, x, neighbor, stencil::Neighbors());
+    const uint32 exceedMask = neighborExceedMask(cPixel, neighbor, threshold);
+    if(exceedMask == 0 || exceedMask == 0xff)
+        return exceedMask != 0;
+
+    Sum windowSums[8];
+    uint8 windowSame[8];
+    for(uint8 dir = 0; dir < 8; dir++) {
+        const size_t ny = y + stencil::adjacentRows[dir] - 1;
+        const uint32 nx = x + stencil::adjacentCols[dir];
+        if(ny == 0 || ny == h - 1 || nx == 0 || nx == w - 1) {
+            windowSums[dir] = 0;
+            windowSame[dir] = 0;
+            continue;
+        }
+        const Pixel* const around[3] = {rows.row(ny - 1), rows.row(ny), rows.row(ny + 1)};
+        windowSums[dir] = stencil::neighborSum<Sum>(around, nx, stencil::Neighbors());
+        windowSame[dir] = stencil::sameCount(around, nx, stencil::Neighbors());
+    }
+    return hierarchyPixel(cPixel, neighbor, windowSums, windowSame, exceedMask);
+}
+
+// Проверка методом иерархий только кандидатов строки y (каскадный режим), hits - номера столбцов кандидатов
+template<typename Pixel>
+void hierarchyCandidates(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, size_t y, const uint32* hits, uint32 count,
+                         const typename PixelTraits<Pixel>::Threshold threshold, DefectMap* out) {
+    for(uint32 i = 0; i < count; i++) {
+        if(hierarchyAt(rows, w, h, y, hits[i], threshold))
+            out->insert(y * w + hits[i]);
+    }
+}
+
+/* Проверка одного пикселя выбранными методами по тем же формулам, что и при проверке строк,
+ * поэтому ответ совпадает с полным проходом (для вещественных пикселей - с точностью до округления
+ * сумм 5*5, которые полный проход считает скользящими).
+ * Возвращает маску методов (бит - номер метода), отобравших пиксель. Нужны строки index / w - 2 .. index / w + 2.
+ */
+template<typename Pixel>
+uint32 verifyPixel(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, size_t index,
+                   const typename PixelTraits<Pixel>::Threshold threshold, uint8 methods) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    typedef typename PixelTraits<Pixel>::Value Value;
+    const uint32 x = uint32(index % w);
+    const size_t y = index / w;
+    // Методы не проверяют крайние пиксели (среднее 5*5 - две крайних строки и столбца)
+    if(x < 1 || y < 1 || x + 1 >= w || y + 1 >= h)
+        return 0;
+    const Pixel* const rows3[3] = {rows.row(y - 1), rows.row(y), rows.row(y + 1)};
+    const Pixel cPixel = rows3[1][x];
+    uint32 mask = 0;
+    if(methods & METHOD_AVG3) {
+        const Sum sum = stencil::neighborSum<Sum>(rows3, x, stencil::Neighbors());
+        mask |= uint32(stencil::exceeds(Value(sum / 8) - Value(cPixel), threshold)) << 0;
+    }
+    if((methods & METHOD_AVG5) && x >= 2 && y >= 2 && x + 2 < w && y + 2 < h) {
+        Sum sum = 0;
+        for(size_t yy = y - 2; yy <= y + 2; yy++) {
+            const Pixel* row = rows.row(yy);
+            for(uint32 xx = x - 2; xx <= x + 2; xx++)
+                sum += row[xx];
+        }
+        mask |= uint32(stencil::exceeds(Value((sum - cPixel) / 24) - Value(cPixel), threshold)) << 1;
+    }
+    if(methods & METHOD_MEDIAN3) {
+        const Pixel m = stencil::median3(rows3[0], rows3[1], rows3[2], x);
+        mask |= uint32(stencil::exceeds(Value(m) - Value(cPixel), threshold)) << 2;
+    }
+    if(methods & METHOD_HIERARCHY3)
+        mask |= uint32(hierarchyAt(rows, w, h, y, x, threshold)) << 3;
+    return mask;
+}
+
+// Запись маски методов, отобравших пиксель index, в наборы результатов
+void insertMask(size_t index, uint32 mask, DefectMap* const out[numberOfMethods]) {
+    for(uint8 m = 0; m < numberOfMethods; m++) {
+        if((mask >> m) & 1)
+            out[m]->insert(index);
+    }
+}
+
+/*!
+ * \brief Проверка строк [yBegin, yEnd) всеми выбранными методами.
+ * Суммы соседей 3*3 (используются методами среднего 3*3 и иерархий) и количество соседей того же цвета
+ * хранятся в кольцевом буфере из 3 строк: перед проверкой строки y вычисляются значения для строки y+1
+ * на место строки y-2. Каждая строка проверяется всеми выбранными методами, пока она находится в кэше.
+ * Среднее 5*5 считается по скользящим суммам полосами, помещающимися в кэш. Строки за границами диапазона,
+ * нужные для окрестностей (ореол), читаются из растра, но не проверяются.
+ * Порог переводится в диапазон типа пикселя один раз на диапазон строк.
+ * В каскадном режиме (SEARCH_CASCADE) метод иерархий сначала отбирает кандидатов строки (deviationRow)
+ * и проверяет только их (см. hierarchyCandidates); строки кольцевого буфера считаются лишь для строк,
+ * в которых кандидатов больше 1/cascadeDenseShare ширины.
+ * Если передан metrics, время шагов и счётчики копятся локально и добавляются в metrics в конце диапазона.
+ * Если передан visit (только для 16-битных пикселей), суммы соседей каждой строки передаются ему
+ * сразу после проверки строки методом среднего 3*3.
+ */
+template<typename Pixel>
+void fusedRows(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const uint16 threshold16, uint8 methods,
+               size_t yBegin, size_t yEnd, DefectMap* const out[numberOfMethods], FrameMetrics* metrics,
+               const NeighborRowVisitor* visit) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    const typename PixelTraits<Pixel>::Threshold threshold = PixelTraits<Pixel>::threshold(threshold16);
+    const bool cascade = methods & SEARCH_CASCADE;
+    const bool needSums = (methods & (METHOD_AVG3 | METHOD_HIERARCHY3)) || visit;
+    const bool needSame = methods & METHOD_HIERARCHY3;
+    const size_t band = bandHeight<Pixel>(w);
+    // Кольцевой буфер сумм и количеств совпадающих соседей, столбцовые суммы среднего 5*5 и номера
+    // отобранных столбцов строки лежат в рабочей памяти потока
+    const size_t sumsBytes = needSums ? scratchPart(3 * w * sizeof(Sum)) : 0;
+    const size_t sameBytes = needSame ? scratchPart(3 * w) : 0;
+    const size_t colBytes = methods & METHOD_AVG5 ? scratchPart(2 * w * sizeof(Sum)) : 0;
+    const size_t scratch = sumsBytes + sameBytes + colBytes + scratchPart(w * sizeof(uint32));
+    uint8* buffer = threadScratch(scratch);
+    // Строка r хранится в кольцевом буфере под номером r % 3
+    Sum* sums = needSums ? reinterpret_cast<Sum*>(buffer) : nullptr;
+    uint8* same = needSame ? buffer + sumsBytes : nullptr;
+    Sum* colSums = colBytes ? reinterpret_cast<Sum*>(buffer + sumsBytes + sameBytes) : nullptr;
+    uint32* hits = reinterpret_cast<uint32*>(buffer + sumsBytes + sameBytes + colBytes); // Номера столбцов, отобранных в строке
+    uint64 stepNs[numberOfSteps] = {0};
+    uint64 candidates = 0, denseRows = 0;
+    // Выполнение шага с замером времени (только при сборе показателей)
+    auto timed = [&](MetricStep step, auto&& run) {
+        if(!metrics) {
+            run();
+            return;
+        }
+        const auto start = chrono::steady_clock::now();
+        run();
+        stepNs[step] += elapsedNanoseconds(start);
+    };
+    if(metrics)
+        metrics->allocate(scratch);
+    // Какая строка посчитана в ячейке буфера (суммы и количества совпадающих соседей отдельно)
+    size_t sumsRow[3] = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+    size_t sameRow[3] = {SIZE_MAX, SIZE_MAX, SIZE_MAX};
+    auto ringSums = [&](size_t r) { return sums + r % 3 * w; };
+    auto ringSame = [&](size_t r) { return same + r % 3 * w; };
+    // Вычисление строки r в буфере, если её там ещё нет
+    auto precomputeRow = [&](size_t r, bool withSame) {
+        if(sumsRow[r % 3] == r && (!withSame || sameRow[r % 3] == r))
+            return;
+        precomputeNeighbors(rows, w, h, r, r + 1, ringSums(r), withSame ? ringSame(r) : nullptr);
+        sumsRow[r % 3] = r;
+        sameRow[r % 3] = withSame ? r : SIZE_MAX;
+    };
+
+    yBegin = max(yBegin, size_t(1));
+    yEnd = min(yEnd, size_t(h - 1));
+    for(size_t y0 = yBegin; y0 < yEnd; y0 += band) {
+        const size_t y1 = min(y0 + band, yEnd);
+        if(methods & METHOD_AVG5)
+            timed(STEP_AVG5, [&] { avgBoxRows<5>(rows, w, h, 5, y0, y1, colSums, threshold, hits, out[1]); });
+
+        for(size_t y = y0; y < y1; y++) {
+            const size_t rowOffset = y * w;
+            const Pixel* rows3[3] = {rows.row(y - 1), rows.row(y), rows.row(y + 1)};
+            if((methods & METHOD_AVG3) || visit) {
+                // Количества совпадающих соседей считаются вместе с суммами, если их всё равно понадобится считать
+                timed(STEP_PRECOMPUTE, [&] { precomputeRow(y, (methods & METHOD_HIERARCHY3) && !cascade); });
+                if(methods & METHOD_AVG3)
+                    timed(STEP_AVG3, [&] { avg3Row(rows3[1], ringSums(y), w, rowOffset, threshold, hits, out[0]); });
+                if constexpr(is_same<Pixel, uint16>::value) {
+                    if(visit)
+                        (*visit)(y, rows3[1], ringSums(y));
+                }
+            }
+            if(methods & METHOD_MEDIAN3)
+                timed(STEP_MEDIAN3, [&] { median3Row(rows3, w, rowOffset, threshold, hits, out[2]); });
+            if(methods & METHOD_HIERARCHY3) {
+                uint32 count = 0;
+                if(cascade) {
+                    timed(STEP_PREFILTER, [&] {
+                        count = StencilKernels<Pixel>::deviationRow(rows3[0], rows3[1], rows3[2], 1, w - 1, threshold, hits);
+                    });
+                }
+                /* Для каждого кандидата суммы соседей считаются заново по окрестности 5*5.
+                 * Если кандидатов много, дешевле посчитать строки буфера и проверить строку целиком.
+                 */
+                if(!cascade || count > w / cascadeDenseShare) {
+                    timed(STEP_PRECOMPUTE, [&] {
+                        for(size_t r = y - 1; r <= y + 1; r++)
+                            precomputeRow(r, true);
+                    });
+                    const Sum* sumRows[3] = {ringSums(y - 1), ringSums(y), ringSums(y + 1)};
+                    const uint8* sameRows[3] = {ringSame(y - 1), ringSame(y), ringSame(y + 1)};
+                    timed(STEP_HIERARCHY3, [&] { hierarchy3Row(rows3, sumRows, sameRows, w, rowOffset, threshold, out[3]); });
+                    candidates += w - 2;
+                    denseRows += cascade;
+                }
+                else {
+                    timed(STEP_HIERARCHY3, [&] { hierarchyCandidates(rows, w, h, y, hits, count, threshold, out[3]); });
+                    candidates += count;
+                }
+            }
+        }
+    }
+
+    if(metrics) {
+        for(uint8 step = 0; step < numberOfSteps; step++)
+            metrics->stepNs[step] += stepNs[step];
+        metrics->pixelsScanned += uint64(yEnd > yBegin ? yEnd - yBegin : 0) * (w - 2);
+        metrics->candidates += candidates;
+        metrics->denseRows += denseRows;
+        metrics->release(scratch);
+    }
+}
+
+/*!
+ * \brief Разбиение изображения на горизонтальные полосы, их обработка в пуле потоков и объединение результатов.
+ * Каждая полоса записывает результаты в собственные наборы, охватывающие только её строки.
+ * Наборы объединяются в порядке полос, поэтому результат совпадает с последовательным.
+ * \param pool - пул потоков (nullptr - последовательная обработка)
+ * \param w - ширина изображения
+ * \param yBegin - первая строка
+ * \param yEnd - строка, следующая за последней
+ * \param out - наборы результатов (nullptr для невыбранных методов)
+ * \param process - обработка строк [y0, y1) с записью в наборы полосы
+ */
+void parallelRows(ThreadPool* pool, uint32 w, size_t yBegin, size_t yEnd, DefectMap* const out[numberOfMethods],
+                  const function<void(size_t, size_t, DefectMap* const*)>& process, FrameMetrics* metrics = nullptr) {
+    const size_t h = yEnd - yBegin;
+    // Задач больше, чем потоков, чтобы простаивающие потоки могли перехватывать работу
+    const size_t tasks = pool ? min(h, size_t(pool->threadCount()) * 4) : 1;
+    if(tasks <= 1) {
+        process(yBegin, yEnd, out);
+        return;
+    }
+    const size_t rowsPerTask = (h + tasks - 1) / tasks;
+    vector<DefectMap> parts(tasks * numberOfMethods);
+    pool->run(tasks, [&](size_t task) {
+        const size_t y0 = yBegin + task * rowsPerTask;
+        const size_t y1 = min(yEnd, y0 + rowsPerTask);
+        if(y0 >= y1)
+            return;
+        DefectMap* partOut[numberOfMethods];
+        for(uint8 m = 0; m < numberOfMethods; m++) {
+            DefectMap& part = parts[task * numberOfMethods + m];
+            part = DefectMap((y1 - y0) * w, y0 * w);
+            partOut[m] = out[m] ? &part : nullptr;
+        }
+        process(y0, y1, partOut);
+    });
+    StageTimer timer(metrics, STAGE_MERGE);
+    for(size_t task = 0; task < tasks; task++) {
+        for(uint8 m = 0; m < numberOfMethods; m++) {
+            if(out[m])
+                out[m]->unite(parts[task * numberOfMethods + m]);
+        }
+    }
+}
+
+/*!
+ * \brief Совмещённый поиск битых пикселей в растре с произвольным шагом строк (см. fusedBrokenPixelSearch)
+ * \param visit - обработка сумм соседей каждой внутренней строки (nullptr - не нужна)
+ */
+template<typename Pixel>
+void fusedSearch(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                 DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool, FrameMetrics* metrics, const NeighborRowVisitor* visit) {
+    const size_t npixels = size_t(w) * h;
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        brokenPixels[m] = methods & (1 << m) ? new DefectMap(npixels) : nullptr;
+
+    if(w < 3 || h < 3)
+        return;
+    parallelRows(pool, w, 0, h, brokenPixels, [&](size_t y0, size_t y1, DefectMap* const* out) {
+        fusedRows(rows, w, h, threshold, methods, y0, y1, out, metrics, visit);
+    }, metrics);
+}
+
+// Запуск одного метода через совмещённый проход
+template<typename Pixel>
+DefectMap* singleMethodSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, uint8 method, ThreadPool* pool) {
+    DefectMap* brokenPixels[numberOfMethods];
+    fusedBrokenPixelSearch(raster, w, npixels, threshold, method, brokenPixels, pool);
+    for(uint8 m = 0; m < numberOfMethods; m++) {
+        if(method & (1 << m))
+            return brokenPixels[m];
+    }
+    return nullptr;
+}
+
+} // namespace
+
+/*!
+ * \brief Поиск битых пикселей посредством сравнения их со средним значением окружающих пикселей в квадрате k*k
+ * Среднее считается без учёта центрального(проверяемого) пикселя по скользящим суммам,
+ * поэтому время работы не зависит от размера квадрата. Для квадратов 3*3, 5*5 и 7*7 используются
+ * ядра, специализированные под размер при компиляции.
+ * \param raster - массив пикселей
+ * \param w - ширина изображения
+ * \param npixels - количество пикселей
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param k - размер поля для вычисления среднего значения, любое нечётное число от 3
+ * \param pool - пул потоков для обработки полосами (nullptr - последовательно)
+ * \return Возвращается набор индексов пикселей, отобранных алгоритмом. Вслучае неверного значения параметра k возращает nullptr.
+ */
+template<typename Pixel>
+DefectMap* avgBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, uint8 k, ThreadPool* pool) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    if(k < 3 || k % 2 == 0)
+        return nullptr;
+    DefectMap* brokenPixels[numberOfMethods] = {new DefectMap(npixels), nullptr, nullptr, nullptr};
+    const uint32 h = npixels / w;
+    const BasicRasterRows<Pixel> rows = {raster, w, 0};
+    const typename PixelTraits<Pixel>::Threshold t = PixelTraits<Pixel>::threshold(threshold);
+    parallelRows(pool, w, 0, h, brokenPixels, [&](size_t y0, size_t y1, DefectMap* const* out) {
+        Sum* colSums = new Sum[2 * w];
+        uint32* hits = new uint32[w];
+        switch(k) {
+        case 3:
+            avgBoxRows<3>(rows, w, h, k, y0, y1, colSums, t, hits, out[0]);
+            break;
+        case 5:
+            avgBoxRows<5>(rows, w, h, k, y0, y1, colSums, t, hits, out[0]);
+            break;
+        case 7:
+            avgBoxRows<7>(rows, w, h, k, y0, y1, colSums, t, hits, out[0]);
+            break;
+        default:
+            avgBoxRows<0>(rows, w, h, k, y0, y1, colSums, t, hits, out[0]);
+            break;
+        }
+        delete[] colSums;
+        delete[] hits;
+    });
+    return brokenPixels[0];
+}
+
+/*!
+ * \brief Поиск битых пикселей посредством сравнения с медианой пикселей(реализовано для квадрата 3*3)
+ * \param raster - массив пикселей
+ * \param w - ширина изображения
+ * \param npixels - количество пикселей
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param pool - пул потоков для обработки полосами (nullptr - последовательно)
+ * \return Возвращается набор индексов пикселей отобранных алгоритмом.
+ */
+template<typename Pixel>
+DefectMap* medianBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, ThreadPool* pool) {
+    return singleMethodSearch(raster, w, npixels, threshold, METHOD_MEDIAN3, pool);
+}
+
+/*!
+ * \brief Поиск битых пикселей методом иерархий(реализовано для квадрата 3*3)
+ * \param raster - массив пикселей
+ * \param w - ширина изображения
+ * \param npixels - количество пикселей
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param pool - пул потоков для обработки полосами (nullptr - последовательно)
+ * \return Возвращается набор индексов пикселей отобранных алгоритмом.
+ */
+template<typename Pixel>
+DefectMap* hierarchyBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, ThreadPool* pool) {
+    /* Алгоритм подбирает подходящий цвет основываясь на сумме весовых коэффициентах 3-х критериев
+     *
+     * Критерий 1
+     * 1.Для каждого соседа вычисяется среднее значение его соседей без учета проверяемого
+     * 2.Считается отличие среднего значения каждого соседа от максимального значения цвета и переводится в значение диапазона [0,1]
+     * 3.Для каждого соседа вычисляется вес значений из п.2(значение делится на сумму всех значений)
+     *
+     * Критерий 2
+     * 1.Для каждого соседа вычисляется количество пикселей такого же цвета без учета проверяемого
+     * 2.Для каждого соседа вычисляется вес значений и п.1(значение делится на сумму всех значений)
+     *
+     * Критерий 3
+     * 1.Для каждой пары противоположных соседей считается разница значений цветов
+     * 2.Считается отличие разницы значений каждой пары от максимального значения цвета и переводится в значение диапазона [0,1]
+     * 3.Для каждого соседа вычисляется вес значений из п.2(значение делится на сумму всех значений)
+     */
+
+    /* Для оптимизации, алгоритм был преобразован следующим образом:
+     * К1: Т.к. среднее значение окружающих пикселей может использоваться до 8 раз,
+     * сначала считаются суммы окружающих пикселей для каждого пикселя полосы(исключая полосу в 1 пиксель по краям изображения).
+     * Таким образом для вычисления ср. знач. достаточно вычесть значение исключаемого пикселя и поделить на 7.
+     * Вес среднего значения отличия пикселя от максимального значения цвета(мзц) - это отношение разницы мзц и среднего значения пикселя к разнице мзц*7 и суммы средних значений всех соседей.
+     * Умножение на 7 получается из суммы отличий всех пикселей(всего окружающих пикселей 8), кроме проверяемого пикселя.
+     *
+     * К2: Т.к. количество соседей такого же пикселя может использоваться до 8 раз,
+     * сначала считается количество таких же пикселей среди соседей для каждого пикселя полосы(исключая полосу в 1 пиксель по краям изображения).
+     * Вес количества похожих пикселей расчитывается как отношение этого значения для соседнего пикселя к сумме значений всех соседей.
+     *
+     * К3: Разница противоположных пикселей вычисляется 4 раза - для каждой пары.
+     * Значение суммы увеличивается в 2 раза т.к. для корректной работы разница должна быть высчитана для всех 8 пикселей
+     * Вес расчитывается как отношение разницы мзц и отличия пикселей в паре к сумме отличий.
+     *
+     * Суммы и количества хранятся в кольцевом буфере из 3 строк. Веса всех критериев приводятся
+     * к общему знаменателю, и соседи сравниваются по целочисленным числителям (см. hierarchyDirection);
+     * если все соседи дают одинаковый ответ, выбор соседа не нужен вовсе.
+     */
+    return singleMethodSearch(raster, w, npixels, threshold, METHOD_HIERARCHY3, pool);
+}
+
+/*!
+ * \brief Совмещённый поиск битых пикселей несколькими методами за один проход по изображению.
+ * Изображение делится на горизонтальные полосы, которые обрабатываются в пуле потоков;
+ * внутри полосы все методы разделяют загрузку окрестностей и суммы соседей 3*3 (см. fusedRows).
+ * \param raster - массив пикселей
+ * \param w - ширина изображения
+ * \param npixels - количество пикселей
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - массив результатов, индекс соответствует номеру бита метода.
+ * Для выбранных методов записывается набор индексов отобранных пикселей, для остальных nullptr.
+ * \param pool - пул потоков (nullptr - последовательная обработка)
+ * \param metrics - показатели кадра (nullptr - без замеров)
+ */
+template<typename Pixel>
+void fusedBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, uint8 methods,
+                            DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool, FrameMetrics* metrics) {
+    const BasicRasterRows<Pixel> rows = {raster, w, 0};
+    fusedBrokenPixelSearch(rows, w, uint32(npixels / w), threshold, methods, brokenPixels, pool, metrics);
+}
+
+/*!
+ * \brief Совмещённый поиск битых пикселей в растре с произвольным шагом строк
+ * (например, в отображённом в память файле, см. MappedImage)
+ * \param rows - строки растра
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - массив результатов (см. fusedBrokenPixelSearch)
+ * \param pool - пул потоков (nullptr - последовательная обработка)
+ * \param metrics - показатели кадра, в которые добавляются время шагов и счётчики (nullptr - без замеров)
+ */
+template<typename Pixel>
+void fusedBrokenPixelSearch(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                            DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool, FrameMetrics* metrics) {
+    fusedSearch(rows, w, h, threshold, methods, brokenPixels, pool, metrics, nullptr);
+}
+
+/*!
+ * \brief Совмещённый поиск битых пикселей в 16-битном растре, который попутно передаёт суммы 8 соседей
+ * каждой внутренней строки обработчику visit - те же суммы, по которым работает метод среднего 3*3.
+ * Так попиксельная статистика по соседям (см. TemporalMap) собирается без второго прохода по изображению.
+ * Строки обрабатываются полосами в пуле потоков, каждая строка передаётся ровно одному вызову visit.
+ * \param visit - обработка строки
+ * Остальные параметры совпадают с fusedBrokenPixelSearch.
+ */
+void fusedBrokenPixelSearch(const RasterRows& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                            DefectMap* brokenPixels[numberOfMethods], const NeighborRowVisitor& visit, ThreadPool* pool,
+                            FrameMetrics* metrics) {
+    fusedSearch(rows, w, h, threshold, methods, brokenPixels, pool, metrics, &visit);
+}
+
+/*!
+ * \brief Совмещённый поиск битых пикселей с построчной подачей изображения.
+ * Изображение не загружается целиком: в памяти держится окно из полос строк вместе с ореолом
+ * в 2 строки сверху и снизу, нужным для окрестностей 5*5 и сумм соседей метода иерархий.
+ * После обработки окна ореол переносится в его начало, а остальная часть заполняется следующими строками.
+ * Объём памяти для обработки зависит только от ширины изображения (и числа потоков), но не от высоты.
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param readRows - чтение следующих count строк в массив dst, возвращает false при ошибке
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - массив результатов (см. fusedBrokenPixelSearch)
+ * \param pool - пул потоков (nullptr - последовательная обработка)
+ * \param metrics - показатели кадра (nullptr - без замеров)
+ * \return В случае успеха вернёт true, при ошибке чтения false
+ */
+template<typename Pixel>
+bool streamingBrokenPixelSearch(uint32 w, uint32 h, const BasicRowSource<Pixel>& readRows, const uint16 threshold, uint8 methods,
+                                DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool, FrameMetrics* metrics) {
+    const size_t npixels = size_t(w) * h;
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        brokenPixels[m] = methods & (1 << m) ? new DefectMap(npixels) : nullptr;
+    if(w < 3 || h < 3)
+        return readRows(nullptr, 0);
+
+    const size_t halo = 2;
+    const size_t step = bandHeight<Pixel>(w) * (pool ? pool->threadCount() : 1); // Проверяемых строк на окно
+    const size_t capacity = step + 2 * halo;
+    Pixel* window = new Pixel[capacity * w];
+    if(metrics)
+        metrics->allocate(capacity * w * sizeof(Pixel));
+    size_t firstRow = 0; // Номер строки в начале окна
+    size_t loaded = min(capacity, size_t(h)); // Количество строк в окне
+    bool ok = readRows(window, loaded);
+    size_t done = 0; // Строки [0, done) проверены
+
+    while(ok && done < h) {
+        // Строку можно проверить, если в окне есть её ореол или она у нижнего края изображения
+        const size_t available = firstRow + loaded;
+        const size_t yEnd = available == h ? h : available - halo;
+        const BasicRasterRows<Pixel> rows = {window, w, firstRow};
+        parallelRows(pool, w, done, yEnd, brokenPixels, [&](size_t y0, size_t y1, DefectMap* const* out) {
+            fusedRows(rows, w, h, threshold, methods, y0, y1, out, metrics, nullptr);
+        }, metrics);
+        done = yEnd;
+        if(done >= h)
+            break;
+
+        // Ореол уже проверенных строк переносится в начало окна
+        const size_t keepFrom = done - halo;
+        const size_t kept = available - keepFrom;
+        copy(window + (keepFrom - firstRow) * w, window + loaded * w, window);
+        firstRow = keepFrom;
+        const size_t count = min(capacity - kept, h - available);
+        ok = readRows(window + kept * w, count);
+        loaded = kept + count;
+    }
+    if(metrics)
+        metrics->release(capacity * w * sizeof(Pixel));
+    delete[] window;
+    return ok;
+}
+
+/*!
+ * \brief Повторная проверка известных битых пикселей выбранными методами.
+ * Методы вычисляются только в окрестностях пикселей набора known, поэтому время работы зависит
+ * от количества пикселей, а не от размера изображения. Ответ для каждого пикселя совпадает с полным проходом.
+ * \param rows - строки растра (например, отображённого в память файла: читаются только нужные страницы)
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param known - проверяемые пиксели
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - массив результатов: для выбранных методов - пиксели known, которые метод по-прежнему отбирает,
+ * для остальных nullptr
+ */
+template<typename Pixel>
+void verifyBrokenPixels(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const DefectMap& known, const uint16 threshold,
+                        uint8 methods, DefectMap* brokenPixels[numberOfMethods]) {
+    const size_t npixels = size_t(w) * h;
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        brokenPixels[m] = methods & (1 << m) ? new DefectMap(npixels) : nullptr;
+    const typename PixelTraits<Pixel>::Threshold t = PixelTraits<Pixel>::threshold(threshold);
+    known.forEach([&](size_t index) {
+        if(index < npixels)
+            insertMask(index, verifyPixel(rows, w, h, index, t, methods), brokenPixels);
+    });
+}
+
+/*!
+ * \brief Повторная проверка известных битых пикселей с чтением только нужных строк.
+ * Пиксели обходятся по возрастанию строк; окрестности соседних пикселей (строки y-2..y+2) объединяются
+ * в окна не больше verifyWindowRows строк, и источник читает только строки окон. Строки между окнами
+ * не запрашиваются, поэтому полосы изображения без известных пикселей не декодируются.
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param readRows - чтение строк [first, first + count) в массив dst; first не убывает, кроме повторного
+ * чтения нескольких строк на стыке окон
+ * \param known - проверяемые пиксели
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - массив результатов (см. verifyBrokenPixels для растра)
+ * \return В случае успеха вернёт true, при ошибке чтения false
+ */
+template<typename Pixel>
+bool verifyBrokenPixels(uint32 w, uint32 h, const BasicRowRangeSource<Pixel>& readRows, const DefectMap& known,
+                        const uint16 threshold, uint8 methods, DefectMap* brokenPixels[numberOfMethods]) {
+    const size_t npixels = size_t(w) * h;
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        brokenPixels[m] = methods & (1 << m) ? new DefectMap(npixels) : nullptr;
+    const typename PixelTraits<Pixel>::Threshold t = PixelTraits<Pixel>::threshold(threshold);
+    const size_t halo = 2;
+    const size_t verifyWindowRows = 64;
+    vector<Pixel> window;
+    vector<size_t> pending; // Пиксели текущего окна
+    size_t first = 0, last = 0; // Строки окна [first, last)
+    bool ok = true;
+    auto flush = [&]() {
+        if(pending.empty() || !ok)
+            return;
+        window.resize((last - first) * w);
+        ok = readRows(window.data(), first, last - first);
+        const BasicRasterRows<Pixel> rows = {window.data(), w, first};
+        for(size_t i = 0; ok && i < pending.size(); i++)
+            insertMask(pending[i], verifyPixel(rows, w, h, pending[i], t, methods), brokenPixels);
+        pending.clear();
+    };
+    known.forEach([&](size_t index) {
+        if(index >= npixels)
+            return;
+        const size_t y = index / w;
+        const size_t need0 = y > halo ? y - halo : 0;
+        const size_t need1 = min(y + halo + 1, size_t(h));
+        // Окрестность продолжает окно, если примыкает к нему и окно не станет слишком высоким
+        if(pending.empty() || need0 > last || need1 - first > verifyWindowRows) {
+            flush();
+            first = need0;
+        }
+        last = need1;
+        pending.push_back(index);
+    });
+    flush();
+    return ok;
+}
+
+// Экземпляры детекторов для поддерживаемых типов пикселей
+#define INSTANTIATE_DETECTORS(Pixel) \
+    template DefectMap* avgBrokenPixelSearch(Pixel*, uint32, size_t, const uint16, uint8, ThreadPool*); \
+    template DefectMap* medianBrokenPixelSearch(Pixel*, uint32, size_t, const uint16, ThreadPool*); \
+    template DefectMap* hierarchyBrokenPixelSearch(Pixel*, uint32, size_t, const uint16, ThreadPool*); \
+    template void fusedBrokenPixelSearch(Pixel*, uint32, size_t, const uint16, uint8, DefectMap*[], ThreadPool*, \
+                                         FrameMetrics*); \
+    template void fusedBrokenPixelSearch(const BasicRasterRows<Pixel>&, uint32, uint32, const uint16, uint8, \
+                                         DefectMap*[], ThreadPool*, FrameMetrics*); \
+    template bool streamingBrokenPixelSearch(uint32, uint32, const BasicRowSource<Pixel>&, const uint16, uint8, \
+                                             DefectMap*[], ThreadPool*, FrameMetrics*); \
+    template void verifyBrokenPixels(const BasicRasterRows<Pixel>&, uint32, uint32, const DefectMap&, const uint16, uint8, \
+                                     DefectMap*[]); \
+    template bool verifyBrokenPixels(uint32, uint32, const BasicRowRangeSource<Pixel>&, const DefectMap&, const uint16, uint8, \
+                                     DefectMap*[]);
+
+INSTANTIATE_DETECTORS(uint8)
+INSTANTIATE_DETECTORS(uint16)
+INSTANTIATE_DETECTORS(float)
@@ -0,0 +1,103 @@
+#ifndef DETECTORS_H
+#define DETECTORS_H
+
+#include <functional>
+#include "defectmap.h"
+#include "tiffio.h"
+
+class ThreadPool;
+struct FrameMetrics;
+
+/*!
+ * \brief Флаги методов поиска битых пикселей.
+ * Номер бита совпадает с индексом метода в массиве результатов.
+ * SEARCH_CASCADE - не метод, а режим поиска (своего результата не имеет): метод иерархий проверяет
+ * только кандидатов, отобранных дешёвой предварительной проверкой (см. stencil::deviationRow).
+ * Результат совпадает с полным перебором.
+ */
+enum DetectionMethod : uint8 {
+    METHOD_AVG3 = 0x01,      // Среднее значение в квадрате 3*3
+    METHOD_AVG5 = 0x02,      // Среднее значение в квадрате 5*5
+    METHOD_MEDIAN3 = 0x04,   // Медиана в квадрате 3*3
+    METHOD_HIERARCHY3 = 0x08, // Метод иерархий
+    METHOD_ALL = 0x0f,
+    SEARCH_CASCADE = 0x10     // Каскадный режим
+};
+
+const uint8 numberOfMethods = 4;
+// Имена методов для разбора параметров и вывода, индекс совпадает с номером бита метода
+const char* const methodNames[numberOfMethods] = {"avg3", "avg5", "median3", "hierarchy3"};
+
+/*!
+ * \brief Доступ к строкам растра: строка y начинается по адресу data + (y - firstRow) * stride
+ */
+template<typename Pixel>
+struct BasicRasterRows {
+    const Pixel* data;
+    size_t stride;   // Расстояние между началами строк в пикселях
+    size_t firstRow; // Номер строки, на которую указывает data
+
+    const Pixel* row(size_t y) const { return data + (y - firstRow) * stride; }
+};
+
+typedef BasicRasterRows<uint16> RasterRows;
+
+// Источник строк для потоковой обработки: чтение следующих count строк в dst
+template<typename Pixel>
+using BasicRowSource = std::function<bool(Pixel* dst, size_t count)>;
+typedef BasicRowSource<uint16> RowSource;
+// Источник строк для выборочного чтения: чтение строк [first, first + count) в dst
+template<typename Pixel>
+using BasicRowRangeSource = std::function<bool(Pixel* dst, size_t first, size_t count)>;
+typedef BasicRowRangeSource<uint16> RowRangeSource;
+// Обработка строки y вместе с суммами 8 соседей каждого пикселя (крайние столбцы не заполняются)
+typedef std::function<void(size_t y, const uint16* row, const uint32* sums)> NeighborRowVisitor;
+
+bool isExceedThreshold(int32 delta, const uint16 threshold);
+uint16 median(uint16 f, uint16 s, uint16 t);
+
+/* Детекторы реализованы шаблонами по типу пикселя для uint8, uint16 и float (см. PixelTraits в stencil.h).
+ * Порог всегда задаётся в единицах 16-битного изображения.
+ */
+template<typename Pixel>
+DefectMap* avgBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, uint8 k,
+                                ThreadPool* pool = nullptr);
+template<typename Pixel>
+DefectMap* medianBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold,
+                                   ThreadPool* pool = nullptr);
+template<typename Pixel>
+DefectMap* hierarchyBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold,
+                                      ThreadPool* pool = nullptr);
+
+template<typename Pixel>
+void fusedBrokenPixelSearch(Pixel* raster, uint32 w, size_t npixels, const uint16 threshold, uint8 methods,
+                            DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool = nullptr, FrameMetrics* metrics = nullptr);
+template<typename Pixel>
+void fusedBrokenPixelSearch(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                            DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool = nullptr, FrameMetrics* metrics = nullptr);
+void fusedBrokenPixelSearch(const RasterRows& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                            DefectMap* brokenPixels[numberOfMethods], const NeighborRowVisitor& visit, ThreadPool* pool = nullptr,
+                            FrameMetrics* metrics = nullptr);
+template<typename Pixel>
+bool streamingBrokenPixelSearch(uint32 w, uint32 h, const BasicRowSource<Pixel>& readRows, const uint16 threshold, uint8 methods,
+                                DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool = nullptr, FrameMetrics* metrics = nullptr);
+// Тип пикселя не выводится из лямбда-функции, поэтому без явного аргумента шаблона читаются 16-битные строки
+inline bool streamingBrokenPixelSearch(uint32 w, uint32 h, const RowSource& readRows, const uint16 threshold, uint8 methods,
+                                       DefectMap* brokenPixels[numberOfMethods], ThreadPool* pool = nullptr,
+                                       FrameMetrics* metrics = nullptr) {
+    return streamingBrokenPixelSearch<uint16>(w, h, readRows, threshold, methods, brokenPixels, pool, metrics);
+}
+
+// Повторная проверка известных пикселей только в их окрестностях (см. detectors.cpp)
+template<typename Pixel>
+void verifyBrokenPixels(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const DefectMap& known, const uint16 threshold,
+                        uint8 methods, DefectMap* brokenPixels[numberOfMethods]);
+template<typename Pixel>
+bool verifyBrokenPixels(uint32 w, uint32 h, const BasicRowRangeSource<Pixel>& readRows, const DefectMap& known,
+                        const uint16 threshold, uint8 methods, DefectMap* brokenPixels[numberOfMethods]);
+inline bool verifyBrokenPixels(uint32 w, uint32 h, const RowRangeSource& readRows, const DefectMap& known,
+                               const uint16 threshold, uint8 methods, DefectMap* brokenPixels[numberOfMethods]) {
+    return verifyBrokenPixels<uint16>(w, h, readRows, known, threshold, methods, brokenPixels);
+}
+
+#endif // DETECTORS_H
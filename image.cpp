@@ -0,0 +1,419 @@
+#include "image.h"
+#include <algorithm>
+#include <atomic>
+#include "threadpool.h"
+
+using namespace std;
+
+namespace {
+
+// Тип пикселей изображения для типа элемента растра
+template<typename Pixel> constexpr PixelType pixelTypeOf();
+template<> constexpr PixelType pixelTypeOf<uint8>() { return PIXEL_UINT8; }
+template<> constexpr PixelType pixelTypeOf<uint16>() { return PIXEL_UINT16; }
+template<> constexpr PixelType pixelTypeOf<float>() { return PIXEL_FLOAT; }
+
+/*!
+ * \brief Проверка конфигурации и размеров открытого изображения
+ * \param tif - открытое изображение
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param type - тип пикселей изображения
+ * \return 0, если изображение поддерживается, иначе код ошибки getImage (2 или 3)
+ */
+uint8 checkImage(TIFF* tif, uint32 &w, uint32 &h, PixelType &type) {
+    uint8 errCode = 0;
+    uint16 t, format = SAMPLEFORMAT_UINT;
+    TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &t);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &format);
+    if(format == SAMPLEFORMAT_UINT && t == 8) type = PIXEL_UINT8;
+    else if(format == SAMPLEFORMAT_UINT && t == 16) type = PIXEL_UINT16;
+    else if(format == SAMPLEFORMAT_IEEEFP && t == 32) type = PIXEL_FLOAT;
+    else errCode = 2;
+    TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &t);
+    if(t != 1) errCode = 2;
+    TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &t);
+    if(t != PHOTOMETRIC_MINISBLACK) errCode = 2;
+    TIFFGetField(tif, TIFFTAG_PLANARCONFIG, &t);
+    if(t != PLANARCONFIG_CONTIG) errCode = 2;
+    if(errCode != 0)
+        return errCode;
+
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+    if(w < 5) errCode = 3;
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+    if(h < 5) errCode = 3;
+    return errCode;
+}
+
+// Проверка изображения, которое читается в растр с пикселями типа Pixel
+template<typename Pixel>
+uint8 checkImage(TIFF* tif, uint32 &w, uint32 &h) {
+    PixelType type;
+    const uint8 errCode = checkImage(tif, w, h, type);
+    if(errCode == 0 && type != pixelTypeOf<Pixel>())
+        return 2;
+    return errCode;
+}
+
+/*!
+ * \brief Определение разбиения изображения на полосы или плитки
+ * \param tif - открытое изображение
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \return Разбиение изображения
+ */
+ImageLayout getLayout(TIFF* tif, uint32 w, uint32 h) {
+    ImageLayout layout;
+    layout.tiled = TIFFIsTiled(tif) != 0;
+    if(layout.tiled) {
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &layout.unitWidth);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &layout.unitHeight);
+        layout.across = (w + layout.unitWidth - 1) / layout.unitWidth;
+        layout.units = layout.across * ((h + layout.unitHeight - 1) / layout.unitHeight);
+    }
+    else {
+        uint32 rowsPerStrip = h;
+        TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip);
+        layout.unitWidth = w;
+        layout.unitHeight = min(rowsPerStrip, h);
+        layout.across = 1;
+        layout.units = (h + layout.unitHeight - 1) / layout.unitHeight;
+    }
+    return layout;
+}
+
+/*!
+ * \brief Декодирование одной полосы или плитки прямо в массив строк.
+ * Полосы читаются прямо в dst, плитки - через tileBuffer с обрезкой по краям изображения.
+ * \param tif - открытое изображение
+ * \param layout - разбиение изображения
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param unit - номер полосы или плитки
+ * \param dst - массив строк шириной w
+ * \param dstFirstRow - номер строки изображения, с которой начинается dst
+ * \param tileBuffer - буфер плитки
+ * \return В случае успеха вернёт 0, иначе 5
+ */
+template<typename Pixel>
+uint8 decodeUnit(TIFF* tif, const ImageLayout& layout, uint32 w, uint32 h, uint32 unit,
+                 Pixel* dst, size_t dstFirstRow, vector<Pixel>& tileBuffer) {
+    const uint32 x0 = unit % layout.across * layout.unitWidth;
+    const uint32 y0 = unit / layout.across * layout.unitHeight;
+    const uint32 rows = min(layout.unitHeight, h - y0);
+    Pixel* out = dst + (y0 - dstFirstRow) * w + x0;
+    if(!layout.tiled) {
+        const tmsize_t size = tmsize_t(rows) * w * sizeof(Pixel);
+        return TIFFReadEncodedStrip(tif, unit, out, size) == -1 ? 5 : 0;
+    }
+    const size_t tilePixels = size_t(layout.unitWidth) * layout.unitHeight;
+    tileBuffer.resize(tilePixels);
+    if(TIFFReadEncodedTile(tif, unit, tileBuffer.data(), tmsize_t(tilePixels * sizeof(Pixel))) == -1)
+        return 5;
+    const uint32 cols = min(layout.unitWidth, w - x0);
+    for(uint32 y = 0; y < rows; y++)
+        copy_n(tileBuffer.data() + size_t(y) * layout.unitWidth, cols, out + size_t(y) * w);
+    return 0;
+}
+
+/*!
+ * \brief Декодирование всего изображения в растр, при наличии пула - параллельно
+ * \param tif - открытое изображение, закрывается функцией
+ * \param path - Путь до изображения (для открытия дескрипторов потоков)
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param raster - массив w*h пикселей
+ * \param pool - пул потоков (nullptr - последовательное декодирование)
+ * \return В случае успеха вернёт 0, иначе 5
+ */
+template<typename Pixel>
+uint8 decodeImage(TIFF* tif, const char* path, uint32 w, uint32 h, Pixel* raster, ThreadPool* pool) {
+    const ImageLayout layout = getLayout(tif, w, h);
+    const size_t tasks = pool ? min(size_t(pool->threadCount()), size_t(layout.units)) : 1;
+    if(tasks <= 1) {
+        uint8 errCode = 0;
+        vector<Pixel> tileBuffer;
+        for(uint32 unit = 0; unit < layout.units && errCode == 0; unit++)
+            errCode = decodeUnit(tif, layout, w, h, unit, raster, 0, tileBuffer);
+        TIFFClose(tif);
+        return errCode;
+    }
+    TIFFClose(tif);
+
+    // Дескриптор TIFF не потокобезопасен, поэтому у каждой задачи свой.
+    // Блоки раздаются по одному, чтобы потоки выравнивались по времени декодирования
+    atomic<uint32> nextUnit(0);
+    atomic<uint8> result(0);
+    pool->run(tasks, [&](size_t) {
+        TIFF* own = TIFFOpen(path, "r");
+        if(!own) {
+            result = 5;
+            return;
+        }
+        vector<Pixel> tileBuffer;
+        for(uint32 unit = nextUnit++; unit < layout.units && result == 0; unit = nextUnit++) {
+            if(decodeUnit(own, layout, w, h, unit, raster, 0, tileBuffer) != 0)
+                result = 5;
+        }
+        TIFFClose(own);
+    });
+    return result;
+}
+
+} // namespace
+
+/*!
+ * \brief Определение типа пикселей изображения без чтения растра
+ * \param path - Путь до изображения
+ * \param type - тип пикселей
+ * \return В случае успеха вернёт 0, иначе код ошибки getImage (1 - 3)
+ */
+uint8 getPixelType(const char* path, PixelType& type) {
+    TIFF* tif = TIFFOpen(path, "r");
+    if(!tif)
+        return 1;
+    uint32 w, h;
+    const uint8 errCode = checkImage(tif, w, h, type);
+    TIFFClose(tif);
+    return errCode;
+}
+
+/*!
+ * \brief Чтения файла изображения и получение массива пикселей и размеров изображения(изображения читается с левого нижнего угла)
+ * Полосы или плитки изображения декодируются независимо, при наличии пула - параллельно,
+ * каждый поток со своим дескриптором файла.
+ * \param path - Путь до изображени
+ * \param raster - Массив в который будут записаны начения пикселей
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param npixels - Количество пикселей
+ * \param pool - пул потоков для декодирования (nullptr - последовательное)
+ * \return В случае успеха вернёт 0, иначе вернёт код ошибки.
+ * Коды ошибок:
+ * 1 - не удалось открыть изображение
+ * 2 - конфигурация изображения не поддерживается или тип пикселей не совпадает с Pixel
+ * 3 - изображение слишком маленькое
+ * 4 - не удалось выделить память
+ * 5 - не удалось прочитать изображение
+ */
+template<typename Pixel>
+uint8 getImage(const char* path, Pixel*& raster, uint32 &w, uint32 &h, size_t &npixels, ThreadPool* pool) {
+    TIFF* tif = TIFFOpen(path, "r");
+    if(!tif)
+        return 1;
+    uint8 errCode = checkImage<Pixel>(tif, w, h);
+    if(errCode != 0) {
+        TIFFClose(tif);
+        return errCode;
+    }
+
+    npixels = size_t(w) * h;
+    raster = new Pixel[npixels];
+    if(raster == NULL) {
+        TIFFClose(tif);
+        return 4;
+    }
+    return decodeImage(tif, path, w, h, raster, pool);
+}
+
+/*!
+ * \brief Чтение файла изображения в переиспользуемый буфер.
+ * Память буфера выделяется заново только если изображение больше всех прочитанных в него ранее.
+ * \param path - Путь до изображения
+ * \param raster - Буфер для пикселей
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param pool - пул потоков для декодирования (nullptr - последовательное)
+ * \return В случае успеха вернёт 0, иначе код ошибки getImage
+ */
+template<typename Pixel>
+uint8 getImage(const char* path, vector<Pixel>& raster, uint32 &w, uint32 &h, ThreadPool* pool) {
+    TIFF* tif = TIFFOpen(path, "r");
+    if(!tif)
+        return 1;
+    const uint8 errCode = checkImage<Pixel>(tif, w, h);
+    if(errCode != 0) {
+        TIFFClose(tif);
+        return errCode;
+    }
+    raster.resize(size_t(w) * h);
+    return decodeImage(tif, path, w, h, raster.data(), pool);
+}
+
+template<typename Pixel>
+BasicScanlineReader<Pixel>::~BasicScanlineReader() {
+    close();
+}
+
+/*!
+ * \brief Открытие изображения для построчного чтения
+ * \param path - Путь до изображения
+ * \return В случае успеха вернёт 0, иначе код ошибки (1 - 3)
+ */
+template<typename Pixel>
+uint8 BasicScanlineReader<Pixel>::open(const char* path) {
+    close();
+    tif = TIFFOpen(path, "r");
+    if(!tif)
+        return 1;
+    const uint8 errCode = checkImage<Pixel>(tif, w, h);
+    if(errCode != 0) {
+        close();
+        return errCode;
+    }
+    layout = getLayout(tif, w, h);
+    // Высокие полосы (например, одна полоса на всё изображение) декодируются построчно,
+    // иначе в памяти оказалась бы вся полоса
+    scanlines = !layout.tiled && layout.unitHeight > maxBlockRows;
+    return 0;
+}
+
+/*!
+ * \brief Чтение следующих count строк.
+ * Строки копируются из текущего ряда полос или плиток, следующий ряд декодируется по мере надобности.
+ * Полосы выше maxBlockRows строк декодируются по строке (TIFFReadScanline), поэтому память не зависит от высоты полосы.
+ * \param dst - массив размером count*width() для строк
+ * \param count - количество строк
+ * \return В случае успеха вернёт 0, иначе 5
+ */
+template<typename Pixel>
+uint8 BasicScanlineReader<Pixel>::readRows(Pixel* dst, uint32 count) {
+    if(!tif || count > h - nextRow)
+        return 5;
+    if(scanlines) {
+        // Переход назад libtiff выполняет повторным декодированием полосы с начала
+        for(; count > 0; count--, nextRow++, dst += w) {
+            if(TIFFReadScanline(tif, dst, nextRow) == -1)
+                return 5;
+            decoded += uint64(w) * sizeof(Pixel);
+        }
+        return 0;
+    }
+    while(count > 0) {
+        if(nextRow < blockFirstRow || nextRow >= blockFirstRow + blockRows) {
+            // Декодирование ряда блоков, содержащего nextRow
+            blockFirstRow = nextRow / layout.unitHeight * layout.unitHeight;
+            blockRows = min(layout.unitHeight, h - blockFirstRow);
+            block.resize(size_t(blockRows) * w);
+            const uint32 first = blockFirstRow / layout.unitHeight * layout.across;
+            for(uint32 unit = first; unit < first + layout.across; unit++) {
+                if(decodeUnit(tif, layout, w, h, unit, block.data(), blockFirstRow, tileBuffer) != 0) {
+                    blockRows = 0;
+                    return 5;
+                }
+            }
+            decoded += uint64(blockRows) * w * sizeof(Pixel);
+        }
+        const uint32 rows = min(count, blockFirstRow + blockRows - nextRow);
+        dst = copy_n(block.data() + size_t(nextRow - blockFirstRow) * w, size_t(rows) * w, dst);
+        nextRow += rows;
+        count -= rows;
+    }
+    return 0;
+}
+
+/*!
+ * \brief Переход к строке row: следующий readRows читает строки начиная с неё.
+ * Полосы или плитки декодируются только при чтении, поэтому пропущенные строки не декодируются.
+ * Переход назад в пределах текущего ряда блоков не требует повторного декодирования.
+ * \param row - номер строки
+ * \return В случае успеха вернёт 0, иначе 5
+ */
+template<typename Pixel>
+uint8 BasicScanlineReader<Pixel>::seek(uint32 row) {
+    if(!tif || row > h)
+        return 5;
+    nextRow = row;
+    return 0;
+}
+
+template<typename Pixel>
+void BasicScanlineReader<Pixel>::close() {
+    if(tif) {
+        TIFFClose(tif);
+        tif = nullptr;
+    }
+    nextRow = 0;
+    blockFirstRow = 0;
+    blockRows = 0;
+    decoded = 0;
+    scanlines = false;
+    vector<Pixel>().swap(block);
+}
+
+template<typename Pixel>
+BasicMappedImage<Pixel>::~BasicMappedImage() {
+    close();
+}
+
+/*!
+ * \brief Проверка раскладки файла и отображение его в память
+ * \param path - Путь до изображения
+ * \param access - ожидаемый порядок чтения строк (ACCESS_RANDOM - читаются только окрестности отдельных пикселей)
+ * \return true, если изображение отображено; false, если его нужно читать через getImage
+ */
+template<typename Pixel>
+bool BasicMappedImage<Pixel>::open(const char* path, FileAccess access) {
+    close();
+    TIFF* tif = TIFFOpen(path, "r");
+    if(!tif)
+        return false;
+    uint16 compression = COMPRESSION_NONE;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+    // Порядок байтов важен только для пикселей больше байта
+    const bool swapped = sizeof(Pixel) > 1 && TIFFIsByteSwapped(tif);
+    if(checkImage<Pixel>(tif, w, h) != 0 || TIFFIsTiled(tif) || swapped || compression != COMPRESSION_NONE) {
+        TIFFClose(tif);
+        return false;
+    }
+
+    // Строки должны лежать с постоянным шагом: полосы по одной строке могут быть разделены
+    // промежутками, строки внутри многострочных полос идут подряд
+    const ImageLayout layout = getLayout(tif, w, h);
+    toff_t* offsets = nullptr;
+    uint64* byteCounts = nullptr;
+    TIFFGetField(tif, TIFFTAG_STRIPOFFSETS, &offsets);
+    TIFFGetField(tif, TIFFTAG_STRIPBYTECOUNTS, &byteCounts);
+    const uint64 rowBytes = uint64(w) * sizeof(Pixel);
+    uint64 strideBytes = rowBytes;
+    if(layout.unitHeight == 1 && layout.units > 1 && offsets && offsets[1] > offsets[0])
+        strideBytes = offsets[1] - offsets[0];
+    bool regular = offsets && byteCounts && strideBytes >= rowBytes
+                   && offsets[0] % sizeof(Pixel) == 0 && strideBytes % sizeof(Pixel) == 0;
+    for(uint32 strip = 0; regular && strip < layout.units; strip++) {
+        const uint64 rows = min(layout.unitHeight, h - strip * layout.unitHeight);
+        regular = offsets[strip] == offsets[0] + uint64(strip) * layout.unitHeight * strideBytes
+                  && byteCounts[strip] >= rows * rowBytes;
+    }
+    const uint64 begin = regular ? offsets[0] : 0;
+    TIFFClose(tif);
+    if(!regular)
+        return false;
+    const uint64 end = begin + uint64(h - 1) * strideBytes + rowBytes;
+    if(!file.open(path, false, access) || file.size() < end) {
+        file.close();
+        return false;
+    }
+    first = reinterpret_cast<const Pixel*>(static_cast<const uint8*>(file.data()) + begin);
+    rowStride = size_t(strideBytes / sizeof(Pixel));
+    return true;
+}
+
+template<typename Pixel>
+void BasicMappedImage<Pixel>::close() {
+    file.close();
+    first = nullptr;
+    rowStride = 0;
+}
+
+// Экземпляры загрузчиков для поддерживаемых типов пикселей
+#define INSTANTIATE_LOADERS(Pixel) \
+    template uint8 getImage(const char*, Pixel*&, uint32&, uint32&, size_t&, ThreadPool*); \
+    template uint8 getImage(const char*, vector<Pixel>&, uint32&, uint32&, ThreadPool*); \
+    template class BasicScanlineReader<Pixel>; \
+    template class BasicMappedImage<Pixel>;
+
+INSTANTIATE_LOADERS(uint8)
+INSTANTIATE_LOADERS(uint16)
+INSTANTIATE_LOADERS(float)
@@ -0,0 +1,117 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <vector>
+#include "mappedfile.h"
+#include "tiffio.h"
+
+class ThreadPool;
+
+/*!
+ * \brief Разбиение изображения на независимо декодируемые блоки: полосы (strips) или плитки (tiles)
+ */
+struct ImageLayout {
+    bool tiled;
+    uint32 unitWidth;  // Ширина блока (для полос - ширина изображения)
+    uint32 unitHeight; // Высота блока
+    uint32 across;     // Блоков в ряду (для полос - 1)
+    uint32 units;      // Всего блоков
+};
+
+/*!
+ * \brief Типы пикселей одноканальных изображений, для которых есть детекторы
+ */
+enum PixelType : uint8 {
+    PIXEL_UINT8 = 0,  // 8 бит без знака
+    PIXEL_UINT16 = 1, // 16 бит без знака
+    PIXEL_FLOAT = 2   // 32-битное число с плавающей точкой, нормированное на [0, 1]
+};
+
+uint8 getPixelType(const char* path, PixelType& type);
+
+/* Загрузчики реализованы шаблонами для uint8, uint16 и float; если тип пикселей файла
+ * не совпадает с Pixel, возвращается код 2 (тип файла можно узнать через getPixelType).
+ */
+template<typename Pixel>
+uint8 getImage(const char* path, Pixel*& raster, uint32 &w, uint32 &h, size_t &npixels, ThreadPool* pool = nullptr);
+template<typename Pixel>
+uint8 getImage(const char* path, std::vector<Pixel>& raster, uint32 &w, uint32 &h, ThreadPool* pool = nullptr);
+
+/*!
+ * \brief Последовательное чтение строк изображения без загрузки его целиком.
+ * Изображение декодируется рядами полос или плиток, поэтому поддерживаются сжатые и плиточные файлы;
+ * полосы выше maxBlockRows строк декодируются по строке. Переход к строке (seek) не декодирует пропущенные полосы.
+ * Коды ошибок совпадают с кодами getImage.
+ */
+template<typename Pixel>
+class BasicScanlineReader {
+public:
+    BasicScanlineReader() = default;
+    ~BasicScanlineReader();
+
+    BasicScanlineReader(const BasicScanlineReader&) = delete;
+    BasicScanlineReader& operator=(const BasicScanlineReader&) = delete;
+
+    uint8 open(const char* path);
+    uint8 readRows(Pixel* dst, uint32 count);
+    uint8 seek(uint32 row);
+    void close();
+
+    uint32 width() const { return w; }
+    uint32 height() const { return h; }
+    // Номер следующей читаемой строки
+    uint32 position() const { return nextRow; }
+    // Объём декодированных пикселей в байтах с момента открытия (ряды, декодированные повторно, учитываются снова)
+    uint64 decodedBytes() const { return decoded; }
+
+private:
+    TIFF* tif = nullptr;
+    uint32 w = 0, h = 0;
+    uint32 nextRow = 0;
+    ImageLayout layout = {};
+    std::vector<Pixel> block;      // Декодированный ряд блоков
+    uint32 blockFirstRow = 0;      // Первая строка ряда в block
+    uint32 blockRows = 0;          // Строк в block (0 - ряд не загружен)
+    std::vector<Pixel> tileBuffer; // Буфер одной плитки
+    uint64 decoded = 0;
+    bool scanlines = false;        // Полосы слишком высокие, строки декодируются по одной
+    static const uint32 maxBlockRows = 64; // Самая высокая полоса, которая декодируется целиком
+};
+
+typedef BasicScanlineReader<uint16> ScanlineReader;
+
+/*!
+ * \brief Несжатое изображение, отображённое в память.
+ * Строки читаются прямо из страниц файла без выделения памяти под растр и копирования.
+ * Подходит только для несжатых изображений из полос с пикселями типа Pixel в порядке байтов процессора,
+ * строки которых лежат в файле с постоянным шагом; для остальных open() вернёт false.
+ */
+template<typename Pixel>
+class BasicMappedImage {
+public:
+    BasicMappedImage() = default;
+    ~BasicMappedImage();
+
+    BasicMappedImage(const BasicMappedImage&) = delete;
+    BasicMappedImage& operator=(const BasicMappedImage&) = delete;
+
+    bool open(const char* path, FileAccess access = ACCESS_SEQUENTIAL);
+    void close();
+
+    uint32 width() const { return w; }
+    uint32 height() const { return h; }
+    // Первая строка изображения
+    const Pixel* data() const { return first; }
+    // Шаг строк в пикселях
+    size_t stride() const { return rowStride; }
+
+private:
+    MappedFile file;
+    const Pixel* first = nullptr;
+    size_t rowStride = 0;
+    uint32 w = 0, h = 0;
+};
+
+typedef BasicMappedImage<uint16> MappedImage;
+
+#endif // IMAGE_H
@@ -0,0 +1,79 @@
+#include "kernels.h"
+#include "stencil.h"
+
+#if defined(_MSC_VER) && defined(KERNELS_X86)
+#include <immintrin.h>
+#endif
+
+namespace {
+
+SimdLevel currentLevel = detectSimdLevel();
+
+} // namespace
+
+// Скалярные ядра - шаблоны stencil.h для 16-битных пикселей
+const RowKernels scalarKernels = {stencil::neighborSums<uint16>, stencil::avg3Row<uint16>, stencil::shiftColumnSums<uint16>,
+                                  stencil::avgBoxRow<0, uint16>, stencil::median3Row<uint16>,
+                                  stencil::deviationRow<uint16>};
+
+/*!
+ * \brief Определение лучшего доступного набора инструкций через CPUID
+ * \return Уровень набора инструкций
+ */
+SimdLevel detectSimdLevel() {
+#if defined(KERNELS_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse41 = info[2] & (1 << 19);
+    const bool osxsave = info[2] & (1 << 27);
+    const bool avx = info[2] & (1 << 28);
+    bool avx2 = false;
+    // AVX2 доступен, только если ОС сохраняет регистры ymm (XCR0 биты 1 и 2)
+    if(maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        avx2 = info[1] & (1 << 5);
+    }
+    return avx2 ? SIMD_AVX2 : sse41 ? SIMD_SSE41 : SIMD_SCALAR;
+#elif defined(KERNELS_X86)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if(__builtin_cpu_supports("sse4.1"))
+        return SIMD_SSE41;
+    return SIMD_SCALAR;
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// Текущий набор инструкций
+SimdLevel simdLevel() {
+    return currentLevel;
+}
+
+/*!
+ * \brief Выбор набора инструкций (например, для сравнения векторных ядер со скалярными).
+ * Уровень выше поддерживаемого процессором понижается до доступного.
+ * \param level - требуемый набор инструкций
+ */
+void setSimdLevel(SimdLevel level) {
+    const SimdLevel available = detectSimdLevel();
+    currentLevel = level < available ? level : available;
+}
+
+// Ядра для текущего набора инструкций
+const RowKernels& rowKernels() {
+#ifdef KERNELS_X86
+    switch(currentLevel) {
+    case SIMD_AVX2:
+        return avx2Kernels;
+    case SIMD_SSE41:
+        return sse41Kernels;
+    default:
+        break;
+    }
+#endif
+    return scalarKernels;
+}
@@ -0,0 +1,72 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include "tiffio.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define KERNELS_X86
+#endif
+
+// Включение набора инструкций для отдельной функции (MSVC разрешает интринсики без флагов компиляции)
+#if defined(__GNUC__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+/*!
+ * \brief Наборы инструкций, для которых есть построчные ядра
+ */
+enum SimdLevel : uint8 {
+    SIMD_SCALAR = 0,
+    SIMD_SSE41 = 1,
+    SIMD_AVX2 = 2
+};
+
+/*!
+ * \brief Построчные ядра детекторов для одного набора инструкций.
+ * Все ядра обрабатывают столбцы [x0, x1) одной строки. Ядра проверки записывают в hits номера
+ * столбцов отобранных пикселей по возрастанию и возвращают их количество.
+ * Результаты всех наборов совпадают побитово со скалярными ядрами.
+ */
+struct RowKernels {
+    // Суммы 8 соседей и количество соседей того же цвета для пикселей строки r1 (same может быть nullptr)
+    void (*neighborSums)(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, uint32* sums, uint8* same);
+    // Проверка строки методом среднего 3*3 по суммам 8 соседей
+    uint32 (*avg3Row)(const uint16* row, const uint32* sums, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits);
+    // Сдвиг столбцовых сумм на строку: добавление строки added и вычитание строки removed
+    void (*shiftColumnSums)(uint32* colSums, const uint16* added, const uint16* removed, uint32 x0, uint32 x1);
+    // Проверка строки методом среднего k*k по суммам квадратов boxSums (с центральным пикселем), adjSize = k*k-1
+    uint32 (*avgBoxRow)(const uint16* row, const uint32* boxSums, uint32 x0, uint32 x1, uint32 adjSize, const uint16 threshold, uint32* hits);
+    // Проверка строки r1 методом медианы 3*3
+    uint32 (*median3Row)(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits);
+    // Отбор пикселей строки r1, отличие которых хотя бы от одного соседа 3*3 превышает порог (кандидаты каскада)
+    uint32 (*deviationRow)(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits);
+};
+
+extern const RowKernels scalarKernels;
+#ifdef KERNELS_X86
+extern const RowKernels sse41Kernels;
+extern const RowKernels avx2Kernels;
+#endif
+
+SimdLevel detectSimdLevel();
+SimdLevel simdLevel();
+void setSimdLevel(SimdLevel level);
+const RowKernels& rowKernels();
+
+// Номер младшего установленного бита (mask != 0)
+inline uint32 lowestBit(uint32 mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+#endif // KERNELS_H
@@ -0,0 +1,172 @@
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+
+/* Ядра AVX2: 16 пикселей (16-битные значения) или 8 сумм (32-битные значения) за инструкцию.
+ * Остаток строки, не кратный ширине вектора, обрабатывается скалярными ядрами.
+ */
+
+namespace {
+
+KERNEL_TARGET("avx2")
+inline __m256i load16(const uint16* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+KERNEL_TARGET("avx2")
+inline __m256i load8Wide(const uint16* p) {
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+// Медиана трёх без ветвлений: max(min(a, b), min(max(a, b), c))
+KERNEL_TARGET("avx2")
+inline __m256i median16(__m256i a, __m256i b, __m256i c) {
+    return _mm256_max_epu16(_mm256_min_epu16(a, b), _mm256_min_epu16(_mm256_max_epu16(a, b), c));
+}
+
+// Запись номеров столбцов по маске (бит i соответствует столбцу x + i)
+inline uint32 appendHits(uint32 mask, uint32 x, uint32* hits) {
+    uint32 n = 0;
+    while(mask) {
+        hits[n++] = x + lowestBit(mask);
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+// Маска 16-битных элементов (по биту на элемент) из результата сравнения
+KERNEL_TARGET("avx2")
+inline uint32 mask16(__m256i cmp) {
+    // Упаковка выполняется внутри 128-битных половин: элементы 0-7 попадают в биты 0-7, элементы 8-15 в биты 16-23
+    const uint32 m = _mm256_movemask_epi8(_mm256_packs_epi16(cmp, _mm256_setzero_si256()));
+    return (m & 0xff) | ((m >> 8) & 0xff00);
+}
+
+KERNEL_TARGET("avx2")
+void neighborSums(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, uint32* sums, uint8* same) {
+    uint32 x = x0;
+    for(; x + 16 <= x1; x += 16) {
+        for(uint32 half = 0; half < 16; half += 8) {
+            const uint32 i = x + half;
+            __m256i s = _mm256_add_epi32(_mm256_add_epi32(load8Wide(r0 + i - 1), load8Wide(r0 + i)), load8Wide(r0 + i + 1));
+            s = _mm256_add_epi32(s, _mm256_add_epi32(load8Wide(r1 + i - 1), load8Wide(r1 + i + 1)));
+            s = _mm256_add_epi32(s, _mm256_add_epi32(_mm256_add_epi32(load8Wide(r2 + i - 1), load8Wide(r2 + i)), load8Wide(r2 + i + 1)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + i), s);
+        }
+        if(same) {
+            // Сравнение даёт -1 в совпадающих элементах, поэтому количество получается вычитанием
+            const __m256i c = load16(r1 + x);
+            __m256i count = _mm256_setzero_si256();
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r0 + x - 1)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r0 + x)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r0 + x + 1)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r1 + x - 1)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r1 + x + 1)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r2 + x - 1)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r2 + x)));
+            count = _mm256_sub_epi16(count, _mm256_cmpeq_epi16(c, load16(r2 + x + 1)));
+            const __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(count), _mm256_extracti128_si256(count, 1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(same + x), packed);
+        }
+    }
+    scalarKernels.neighborSums(r0, r1, r2, x, x1, sums, same);
+}
+
+KERNEL_TARGET("avx2")
+uint32 avg3Row(const uint16* row, const uint32* sums, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+    const __m256i t = _mm256_set1_epi32(threshold);
+    uint32 n = 0;
+    uint32 x = x0;
+    for(; x + 8 <= x1; x += 8) {
+        const __m256i avg = _mm256_srli_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(sums + x)), 3);
+        const __m256i c = load8Wide(row + x);
+        const __m256i hit = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_sub_epi32(avg, c), t), _mm256_cmpgt_epi32(_mm256_sub_epi32(c, avg), t));
+        n += appendHits(_mm256_movemask_ps(_mm256_castsi256_ps(hit)), x, hits + n);
+    }
+    return n + scalarKernels.avg3Row(row, sums, x, x1, threshold, hits + n);
+}
+
+KERNEL_TARGET("avx2")
+void shiftColumnSums(uint32* colSums, const uint16* added, const uint16* removed, uint32 x0, uint32 x1) {
+    uint32 x = x0;
+    for(; x + 8 <= x1; x += 8) {
+        __m256i* p = reinterpret_cast<__m256i*>(colSums + x);
+        const __m256i delta = _mm256_sub_epi32(load8Wide(added + x), load8Wide(removed + x));
+        _mm256_storeu_si256(p, _mm256_add_epi32(_mm256_loadu_si256(p), delta));
+    }
+    scalarKernels.shiftColumnSums(colSums, added, removed, x, x1);
+}
+
+// Деление заменено умножением так же, как в ядре SSE4.1
+KERNEL_TARGET("avx2")
+uint32 avgBoxRow(const uint16* row, const uint32* boxSums, uint32 x0, uint32 x1, uint32 adjSize, const uint16 threshold, uint32* hits) {
+    if(adjSize >= 16384)
+        return scalarKernels.avgBoxRow(row, boxSums, x0, x1, adjSize, threshold, hits);
+    const __m256i n8 = _mm256_set1_epi32(adjSize);
+    const __m256i t = _mm256_set1_epi32(threshold);
+    const __m256i one = _mm256_set1_epi32(1);
+    uint32 n = 0;
+    uint32 x = x0;
+    for(; x + 8 <= x1; x += 8) {
+        const __m256i c = load8Wide(row + x);
+        const __m256i s = _mm256_sub_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(boxSums + x)), c);
+        const __m256i upper = _mm256_mullo_epi32(n8, _mm256_add_epi32(_mm256_add_epi32(c, t), one));
+        const __m256i lower = _mm256_mullo_epi32(n8, _mm256_sub_epi32(c, t));
+        const __m256i hit = _mm256_or_si256(_mm256_andnot_si256(_mm256_cmpgt_epi32(upper, s), _mm256_set1_epi32(-1)),
+                                            _mm256_cmpgt_epi32(lower, s));
+        n += appendHits(_mm256_movemask_ps(_mm256_castsi256_ps(hit)), x, hits + n);
+    }
+    return n + scalarKernels.avgBoxRow(row, boxSums, x, x1, adjSize, threshold, hits + n);
+}
+
+KERNEL_TARGET("avx2")
+uint32 median3Row(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+    // При пороге 0xffff модуль разницы не может его превысить
+    if(threshold == 0xffff)
+        return 0;
+    uint32 n = 0;
+    uint32 x = x0;
+    const __m256i t1 = _mm256_set1_epi16(short(threshold + 1));
+    for(; x + 16 <= x1; x += 16) {
+        const __m256i c = load16(r1 + x);
+        const __m256i m0 = median16(c, load16(r1 + x - 1), load16(r1 + x + 1));
+        const __m256i m1 = median16(c, load16(r0 + x), load16(r2 + x));
+        const __m256i m2 = median16(c, load16(r0 + x - 1), load16(r2 + x + 1));
+        const __m256i m3 = median16(c, load16(r2 + x - 1), load16(r0 + x + 1));
+        const __m256i d = median16(c, median16(c, m0, m1), median16(c, m2, m3));
+        // Модуль разницы через вычитание с насыщением, затем сравнение diff >= threshold + 1
+        const __m256i diff = _mm256_max_epu16(_mm256_subs_epu16(d, c), _mm256_subs_epu16(c, d));
+        n += appendHits(mask16(_mm256_cmpeq_epi16(_mm256_max_epu16(diff, t1), diff)), x, hits + n);
+    }
+    return n + scalarKernels.median3Row(r0, r1, r2, x, x1, threshold, hits + n);
+}
+
+KERNEL_TARGET("avx2")
+uint32 deviationRow(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+    if(threshold == 0xffff)
+        return 0;
+    uint32 n = 0;
+    uint32 x = x0;
+    const __m256i t1 = _mm256_set1_epi16(short(threshold + 1));
+    for(; x + 16 <= x1; x += 16) {
+        const __m256i c = load16(r1 + x);
+        const __m256i neighbor[8] = {load16(r0 + x - 1), load16(r0 + x), load16(r0 + x + 1), load16(r1 + x - 1),
+                                     load16(r1 + x + 1), load16(r2 + x - 1), load16(r2 + x), load16(r2 + x + 1)};
+        // Дальше всех от пикселя либо наибольший, либо наименьший из соседей
+        __m256i hi = neighbor[0], lo = neighbor[0];
+        for(uint8 dir = 1; dir < 8; dir++) {
+            hi = _mm256_max_epu16(hi, neighbor[dir]);
+            lo = _mm256_min_epu16(lo, neighbor[dir]);
+        }
+        const __m256i diff = _mm256_max_epu16(_mm256_subs_epu16(hi, c), _mm256_subs_epu16(c, lo));
+        n += appendHits(mask16(_mm256_cmpeq_epi16(_mm256_max_epu16(diff, t1), diff)), x, hits + n);
+    }
+    return n + scalarKernels.deviationRow(r0, r1, r2, x, x1, threshold, hits + n);
+}
+
+} // namespace
+
+const RowKernels avx2Kernels = {neighborSums, avg3Row, shiftColumnSums, avgBoxRow, median3Row, deviationRow};
+
+#endif // KERNELS_X86
@@ -0,0 +1,168 @@
+#include "kernels.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+
+/* Ядра SSE4.1: 8 пикселей (16-битные значения) или 4 суммы (32-битные значения) за инструкцию.
+ * Остаток строки, не кратный ширине вектора, обрабатывается скалярными ядрами.
+ */
+
+namespace {
+
+KERNEL_TARGET("sse4.1")
+inline __m128i load8(const uint16* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+KERNEL_TARGET("sse4.1")
+inline __m128i load4Wide(const uint16* p) {
+    return _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+}
+
+// Медиана трёх без ветвлений: max(min(a, b), min(max(a, b), c))
+KERNEL_TARGET("sse4.1")
+inline __m128i median8(__m128i a, __m128i b, __m128i c) {
+    return _mm_max_epu16(_mm_min_epu16(a, b), _mm_min_epu16(_mm_max_epu16(a, b), c));
+}
+
+// Запись номеров столбцов по маске (бит i соответствует столбцу x + i)
+inline uint32 appendHits(uint32 mask, uint32 x, uint32* hits) {
+    uint32 n = 0;
+    while(mask) {
+        hits[n++] = x + lowestBit(mask);
+        mask &= mask - 1;
+    }
+    return n;
+}
+
+KERNEL_TARGET("sse4.1")
+void neighborSums(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, uint32* sums, uint8* same) {
+    uint32 x = x0;
+    for(; x + 8 <= x1; x += 8) {
+        for(uint32 half = 0; half < 8; half += 4) {
+            const uint32 i = x + half;
+            __m128i s = _mm_add_epi32(_mm_add_epi32(load4Wide(r0 + i - 1), load4Wide(r0 + i)), load4Wide(r0 + i + 1));
+            s = _mm_add_epi32(s, _mm_add_epi32(load4Wide(r1 + i - 1), load4Wide(r1 + i + 1)));
+            s = _mm_add_epi32(s, _mm_add_epi32(_mm_add_epi32(load4Wide(r2 + i - 1), load4Wide(r2 + i)), load4Wide(r2 + i + 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i), s);
+        }
+        if(same) {
+            // Сравнение даёт -1 в совпадающих элементах, поэтому количество получается вычитанием
+            const __m128i c = load8(r1 + x);
+            __m128i count = _mm_setzero_si128();
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r0 + x - 1)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r0 + x)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r0 + x + 1)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r1 + x - 1)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r1 + x + 1)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r2 + x - 1)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r2 + x)));
+            count = _mm_sub_epi16(count, _mm_cmpeq_epi16(c, load8(r2 + x + 1)));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(same + x), _mm_packus_epi16(count, count));
+        }
+    }
+    scalarKernels.neighborSums(r0, r1, r2, x, x1, sums, same);
+}
+
+KERNEL_TARGET("sse4.1")
+uint32 avg3Row(const uint16* row, const uint32* sums, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+    const __m128i t = _mm_set1_epi32(threshold);
+    uint32 n = 0;
+    uint32 x = x0;
+    for(; x + 4 <= x1; x += 4) {
+        const __m128i avg = _mm_srli_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + x)), 3);
+        const __m128i c = load4Wide(row + x);
+        const __m128i hit = _mm_or_si128(_mm_cmpgt_epi32(_mm_sub_epi32(avg, c), t), _mm_cmpgt_epi32(_mm_sub_epi32(c, avg), t));
+        n += appendHits(_mm_movemask_ps(_mm_castsi128_ps(hit)), x, hits + n);
+    }
+    return n + scalarKernels.avg3Row(row, sums, x, x1, threshold, hits + n);
+}
+
+KERNEL_TARGET("sse4.1")
+void shiftColumnSums(uint32* colSums, const uint16* added, const uint16* removed, uint32 x0, uint32 x1) {
+    uint32 x = x0;
+    for(; x + 4 <= x1; x += 4) {
+        __m128i* p = reinterpret_cast<__m128i*>(colSums + x);
+        const __m128i delta = _mm_sub_epi32(load4Wide(added + x), load4Wide(removed + x));
+        _mm_storeu_si128(p, _mm_add_epi32(_mm_loadu_si128(p), delta));
+    }
+    scalarKernels.shiftColumnSums(colSums, added, removed, x, x1);
+}
+
+/* Деление заменено умножением: при s = сумма без центра, c - центр, n = adjSize
+ * floor(s/n) - c > t  <=>  s >= n*(c+t+1)
+ * floor(s/n) - c < -t <=>  s <  n*(c-t)
+ * Произведения помещаются в int32 при n < 16384 (k <= 127), иначе используется скалярное ядро.
+ */
+KERNEL_TARGET("sse4.1")
+uint32 avgBoxRow(const uint16* row, const uint32* boxSums, uint32 x0, uint32 x1, uint32 adjSize, const uint16 threshold, uint32* hits) {
+    if(adjSize >= 16384)
+        return scalarKernels.avgBoxRow(row, boxSums, x0, x1, adjSize, threshold, hits);
+    const __m128i n4 = _mm_set1_epi32(adjSize);
+    const __m128i t = _mm_set1_epi32(threshold);
+    const __m128i one = _mm_set1_epi32(1);
+    uint32 n = 0;
+    uint32 x = x0;
+    for(; x + 4 <= x1; x += 4) {
+        const __m128i c = load4Wide(row + x);
+        const __m128i s = _mm_sub_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(boxSums + x)), c);
+        const __m128i upper = _mm_mullo_epi32(n4, _mm_add_epi32(_mm_add_epi32(c, t), one));
+        const __m128i lower = _mm_mullo_epi32(n4, _mm_sub_epi32(c, t));
+        const __m128i hit = _mm_or_si128(_mm_andnot_si128(_mm_cmpgt_epi32(upper, s), _mm_set1_epi32(-1)), _mm_cmpgt_epi32(lower, s));
+        n += appendHits(_mm_movemask_ps(_mm_castsi128_ps(hit)), x, hits + n);
+    }
+    return n + scalarKernels.avgBoxRow(row, boxSums, x, x1, adjSize, threshold, hits + n);
+}
+
+KERNEL_TARGET("sse4.1")
+uint32 median3Row(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+    // При пороге 0xffff модуль разницы не может его превысить
+    if(threshold == 0xffff)
+        return 0;
+    uint32 n = 0;
+    uint32 x = x0;
+    const __m128i t1 = _mm_set1_epi16(short(threshold + 1));
+    for(; x + 8 <= x1; x += 8) {
+        const __m128i c = load8(r1 + x);
+        const __m128i m0 = median8(c, load8(r1 + x - 1), load8(r1 + x + 1));
+        const __m128i m1 = median8(c, load8(r0 + x), load8(r2 + x));
+        const __m128i m2 = median8(c, load8(r0 + x - 1), load8(r2 + x + 1));
+        const __m128i m3 = median8(c, load8(r2 + x - 1), load8(r0 + x + 1));
+        const __m128i d = median8(c, median8(c, m0, m1), median8(c, m2, m3));
+        // Модуль разницы через вычитание с насыщением, затем сравнение diff >= threshold + 1
+        const __m128i diff = _mm_max_epu16(_mm_subs_epu16(d, c), _mm_subs_epu16(c, d));
+        const __m128i hit = _mm_cmpeq_epi16(_mm_max_epu16(diff, t1), diff);
+        n += appendHits(_mm_movemask_epi8(_mm_packs_epi16(hit, _mm_setzero_si128())), x, hits + n);
+    }
+    return n + scalarKernels.median3Row(r0, r1, r2, x, x1, threshold, hits + n);
+}
+
+KERNEL_TARGET("sse4.1")
+uint32 deviationRow(const uint16* r0, const uint16* r1, const uint16* r2, uint32 x0, uint32 x1, const uint16 threshold, uint32* hits) {
+    if(threshold == 0xffff)
+        return 0;
+    uint32 n = 0;
+    uint32 x = x0;
+    const __m128i t1 = _mm_set1_epi16(short(threshold + 1));
+    for(; x + 8 <= x1; x += 8) {
+        const __m128i c = load8(r1 + x);
+        const __m128i neighbor[8] = {load8(r0 + x - 1), load8(r0 + x), load8(r0 + x + 1), load8(r1 + x - 1),
+                                     load8(r1 + x + 1), load8(r2 + x - 1), load8(r2 + x), load8(r2 + x + 1)};
+        // Дальше всех от пикселя либо наибольший, либо наименьший из соседей
+        __m128i hi = neighbor[0], lo = neighbor[0];
+        for(uint8 dir = 1; dir < 8; dir++) {
+            hi = _mm_max_epu16(hi, neighbor[dir]);
+            lo = _mm_min_epu16(lo, neighbor[dir]);
+        }
+        const __m128i diff = _mm_max_epu16(_mm_subs_epu16(hi, c), _mm_subs_epu16(c, lo));
+        const __m128i hit = _mm_cmpeq_epi16(_mm_max_epu16(diff, t1), diff);
+        n += appendHits(_mm_movemask_epi8(_mm_packs_epi16(hit, _mm_setzero_si128())), x, hits + n);
+    }
+    return n + scalarKernels.deviationRow(r0, r1, r2, x, x1, threshold, hits + n);
+}
+
+} // namespace
+
+const RowKernels sse41Kernels = {neighborSums, avg3Row, shiftColumnSums, avgBoxRow, median3Row, deviationRow};
+
+#endif // KERNELS_X86
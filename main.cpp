@@ -1,386 +1,344 @@
-#include <QSet>
 #include <iostream>
-#include <iomanip>
+#include <cmath>
+#include <csignal>
 #include "tiffio.h"
-#include <time.h>
+#include <chrono>
+#include <filesystem>
+#include "batch.h"
+#include "defectmap.h"
+#include "detectors.h"
+#include "image.h"
+#include "metrics.h"
+#include "output.h"
+#include "temporal.h"
+#include "threadpool.h"
+#include "watch.h"
 
 using namespace std;
 
-/*!
- * \brief Чтения файла изображения и получение массива пикселей и размеров изображения(изображения читается с левого нижнего угла)
- * \param path - Путь до изображени
- * \param raster - Массив в который будут записаны начения пикселей
- * \param w - Ширина изображения
- * \param h - Высота изображения
- * \param npixels - Количество пикселей
- * \return В случае успеха вернёт 0, иначе вернёт код ошибки.
- * Коды ошибок:
- * 1 - не удалось открыть изображение
- * 2 - конфигурация изображения не поддерживается
- * 3 - изображение слишком маленькое
- * 4 - не удалось выделить память
- * 5 - не удалось прочитать изображение
- */
-uint8 getImage(char* path, uint16*& raster, uint32 &w, uint32 &h, size_t &npixels) {
-    uint8 errCode = 0;
-    TIFF* tif = TIFFOpen(path, "r");
-    if(tif) {
-        uint16 t;
-        TIFFGetField(tif, TIFFTAG_BITSPERSAMPLE, &t);
-        if(t != 16) errCode = 2;
-        TIFFGetField(tif, TIFFTAG_SAMPLESPERPIXEL, &t);
-        if(t != 1) errCode = 2;
-        TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &t);
-        if(t != PHOTOMETRIC_MINISBLACK) errCode = 2;
-        TIFFGetField(tif, TIFFTAG_PLANARCONFIG, &t);
-        if(t != PLANARCONFIG_CONTIG) errCode = 2;
-        if(errCode != 0) {
-            TIFFClose(tif);
-            return errCode;
-        }
+// Наблюдение за папкой, которое прерывается по SIGINT и SIGTERM
+DirectoryWatcher* activeWatcher = nullptr;
 
-        TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
-        if(w < 5) errCode = 3;
-        TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
-        if(h < 5) errCode = 3;
-        if(errCode != 0) {
-            TIFFClose(tif);
-            return errCode;
-        }
-
-        npixels = w * h;
-        raster = new uint16[npixels];
-        if(raster != NULL) {
-            for(size_t row = 0; row < h; row++) {
-                if(TIFFReadScanline(tif, raster+row*w, row) == -1) {
-                    errCode = 5;
-                    break;
-                }
-            }
-        }
-        else errCode = 4;
-    }
-    else errCode = 1;
-    TIFFClose(tif);
-    return errCode;
+void stopWatching(int) {
+    if(activeWatcher)
+        activeWatcher->stop();
 }
 
-/*!
- * \brief Проверка того, что разница пикселей превысит заданный порог
- * \param delta - разница значений цветов пикселей
- * \param threshold - пороговое значение
- * \return Если порог превышен, то возвращает true, иначе false
- */
-bool isExceedThreshold(int32 delta, const uint16 threshold) {
-    if(delta >= 0 && delta > threshold) {
-        return true;
-    } else if(delta < 0 && delta < -threshold) {
-        return true;
+// Проверка того, что строка состоит только из цифр
+bool isNumber(const string& str) {
+    if(str.empty())
+        return false;
+    for(auto i : str) {
+        if(!isdigit(i))
+            return false;
     }
-    return false;
+    return true;
 }
 
 /*!
- * \brief Поиск битых пикселей посредством сравнения их со средним значением окружающих пикселей в квадрате k*k
- * Доступные значения:
- * k = 3 - высчитываются значения пикселей в квадрате 3х3 без учёта центрального(проверяемого)
- * k = 5 - вычисление для квадрата 5*5
- * \param raster - массив пикселей
- * \param w - ширина изображения
- * \param npixels - количество пикселей
- * \param threshold - порог по которому будут отбираться искомые пиксели
- * \param k - размер поля для вычисления среднего значения
- * \return Возвращается коллекция индексов пикселей, отобранных алгоритмом. Вслучае неверного значения параметра k возращает nullptr.
+ * \brief Разбор списка методов вида "avg3,median3"
+ * \param str - строка со списком методов через запятую
+ * \param methods - набор флагов DetectionMethod
+ * \return В случае успеха вернёт true, иначе false
  */
-QSet<size_t>* avgBrokenPixelSearch(uint16* raster, uint32 w, size_t npixels, const uint16 threshold, uint8 k) {
-    /* Смещения индекса пикселя для выбора соседних пикселей
-     * 0 - текущий пиксель (на индекс которого указывает переменная итератор)
-     * p - пиксель, со значением которого будет производится сравнение
-     * 5 6 7
-     * 3 p 4
-     * 0 1 2
-     *
-     * 19 20 21 22 23
-     * 14 15 16 17 18
-     * 10 11  p 12 13
-     *  5  6  7  8  9
-     *  0  1  2  3  4
-     */
-    size_t* adjacentPositions; // Массив, где будут храниться смещения (на сколько нужно сместить индекс)
-    uint8 adjSize; // Размер массива смещений
-    size_t lineBorder; // Граница-отступ, до которой может доходить итератор в каждой строке
-    if(k == 3) {
-        adjSize = 8;
-        adjacentPositions = new size_t[adjSize]{0, 1, 2, w, w+2, 2*w, 2*w+1, 2*w+2};
-        lineBorder = w-2;
-    }
-    else if(k == 5) {
-        adjSize = 24;
-        adjacentPositions = new size_t[adjSize]{0, 1, 2, 3, 4, w, w+1, w+2, w+3, w+4, 2*w, 2*w+1, 2*w+3, 2*w+4, 3*w, 3*w+1, 3*w+2, 3*w+3, 3*w+4, 4*w, 4*w+1, 4*w+2, 4*w+3, 4*w+4};
-        lineBorder = w-4;
-    } else {
-        return nullptr;
-    }
-    const size_t comparedPosition = adjacentPositions[adjSize - 1] / 2; // Смещение для проверяемого пикселя(центрального в квадрате k*k)
-    uint32 sum; // Сумма значений пикселей для вычисления среднего
-    QSet<size_t>* brokenPixels = new QSet<size_t>;
-
-    // Итерация изображения по строкам до w-(k-1) и до h-(k-1) по столбцам
-    for(size_t i = 0; i < npixels-adjacentPositions[adjSize - 1]; i++) {
-        if(!(i%w < lineBorder)) // Если итератор вышел за границу строки - пропускаем(исключаем выход квадрата за пределы изображения)
-            continue;
-        sum = 0;
-        for(uint8 pos = 0; pos < adjSize; pos++) { // Суммирования всех пикселей в квадрате k*k кроме цетрального
-                sum += raster[i + adjacentPositions[pos]];
+bool parseMethods(const string& str, uint8& methods) {
+    methods = 0;
+    size_t begin = 0;
+    while(begin <= str.size()) {
+        size_t end = str.find(',', begin);
+        if(end == string::npos)
+            end = str.size();
+        const string name = str.substr(begin, end - begin);
+        uint8 method = 0;
+        for(; method < numberOfMethods; method++) {
+            if(name == methodNames[method])
+                break;
         }
-
-        // Если отличие превышает заданный порог, то индекс пикселя помещается в коллекцию
-        if(isExceedThreshold(sum/adjSize - raster[i + comparedPosition], threshold))
-            *brokenPixels << i + comparedPosition;
+        if(method == numberOfMethods)
+            return false;
+        methods |= 1 << method;
+        begin = end + 1;
     }
-    delete[] adjacentPositions;
-    return brokenPixels;
+    return methods != 0;
 }
 
-// Поиск медианы
-uint16 median(uint16 f, uint16 s, uint16 t) {
-    if(f < s){
-        if(s < t) return s;
-        if(f < t) return t;
-        return f;
+// Вывод сообщения по коду ошибки getImage, TemporalMap, verifyImage или writeDefects
+void printError(uint8 errCode) {
+    switch (errCode) {
+    case 1:
+        cout << "Error: couldn't open the file" << endl;
+        break;
+    case 2:
+        cout << "Error: image configuration is not supported" << endl;
+        break;
+    case 3:
+        cout << "Error: image is too small" << endl;
+        break;
+    case 4:
+        cout << "Error: failed to allocate memory" << endl;
+        break;
+    case 5:
+        cout << "Error: couldn't read the image" << endl;
+        break;
+    case 6:
+        cout << "Error: temporal map doesn't match the image or is damaged" << endl;
+        break;
+    case 7:
+        cout << "Error: couldn't read the list of pixels or it doesn't match the image" << endl;
+        break;
+    case 8:
+        cout << "Error: couldn't write the output file" << endl;
+        break;
     }
-    if(t < s) return s;
-    if(f < t) return f;
-    return t;
 }
 
 /*!
- * \brief Поиск битых пикселей посредством сравнения с медианой пикселей(реализовано для квадрата 3*3)
- * \param raster - массив пикселей
- * \param w - ширина изображения
- * \param npixels - количество пикселей
- * \param threshold - порог по которому будут отбираться искомые пиксели
- * \return Возвращается коллекция индексов пикселей отобранных алгоритмом.
+ * \brief Вывод битых пикселей: таблицей в консоль или в файл выбранного формата
+ * \param brokenPixels - результаты методов (nullptr для невыбранных)
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param outputPath - путь к файлу результата (пустой - таблица в консоль)
+ * \param format - формат файла результата
  */
-QSet<size_t>* medianBrokenPixelSearch(uint16* raster, uint32 w, size_t npixels, const uint16 threshold) {
-    /* Смещения для пар диаметрально противоложных пикселей
-     * число - индекс пары в массиве
-     * p - центральный пиксель, является третим элементом вместе с парой при поиске медианы
-     * 3 1 2
-     * 0 p 0
-     * 2 1 3
-     */
-    const size_t oppositePairsPoss[4][2] {{w, w+2}, {1, 2*w+1}, {0, 2*w+2}, {2*w, 2}};
-    const size_t cPos = w+1; // Позиция проверяемого пикселя
-    uint16 cPixel; // Значение проверяемого пикселя
-    QSet<size_t>* brokenPixels = new QSet<size_t>;
-    int32 delta; // Отличие вычисляемого и фактического значения пикселя
-    // Итерация изображения по строкам до w-2 и до h-2 по столбцам
-    for(size_t i = 0; i < npixels-w-w-2; i++) {
-        if(!(i%w < w-2)) // Исключаем выход квадрата за пределы изображения
-            continue;
-        cPixel = raster[i + cPos];
+void printBrokenPixels(DefectMap* brokenPixels[numberOfMethods], uint32 w, uint32 h, const string& outputPath, OutputFormat format) {
+    const uint8 errCode = writeDefects(outputPath.empty() ? "-" : outputPath, outputPath.empty() ? OUTPUT_TABLE : format, brokenPixels, w, h);
+    if(errCode != 0)
+        printError(errCode);
+    else if(!outputPath.empty())
+        cout << "Saved to: " << outputPath << endl;
+}
 
-        /* Поиск медианы пикселей происходит в порядке:
-         * 1. Для каждой пары вместе с центральным пикселем
-         * 2. Для медиан пар 0 1 и центрального пикселя и медиан пар 2 3 и центрального пикселя
-         * 3. Для медиан из пункта 2 и центрального пикселя
-         */
-        delta = median(//пункт 3
-            cPixel,
-            median(//пунтк 2
-                cPixel,
-                median( cPixel, raster[i + oppositePairsPoss[0][0]], raster[i + oppositePairsPoss[0][1]]),//пункт 1
-                median( cPixel, raster[i + oppositePairsPoss[1][0]], raster[i + oppositePairsPoss[1][1]]) //пункт 1
-            ),//п.2
-            median(//пункт 2
-                cPixel,
-                median( cPixel, raster[i + oppositePairsPoss[2][0]], raster[i + oppositePairsPoss[2][1]]),//пункт 1
-                median( cPixel, raster[i + oppositePairsPoss[3][0]], raster[i + oppositePairsPoss[3][1]]) //пункт 1
-            )//п.2
-        );/*п.3*/
+// Путь к файлу результата кадра в папке folder: имя кадра без расширения с расширением формата
+string frameOutputPath(const string& folder, const string& framePath, OutputFormat format) {
+    const size_t slash = framePath.find_last_of("/\\");
+    string stem = slash == string::npos ? framePath : framePath.substr(slash + 1);
+    const size_t dot = stem.rfind('.');
+    if(dot != string::npos && dot > 0)
+        stem.erase(dot);
+    return folder + "/" + stem + outputExtension(format);
+}
 
-        // Если отличие превышает заданный порог, то индекс пикселя помещается в коллекцию
-        if(isExceedThreshold(delta - raster[i + cPos], threshold))
-            *brokenPixels << i + cPos;
-    }
-    return brokenPixels;
+// Запись показателей кадра; ошибка записи выводится, но не прерывает обработку
+void recordMetrics(MetricsExporter& exporter, const string& path, uint8 errCode, uint32 w, uint32 h, const FrameMetrics& metrics,
+                   DefectMap* const brokenPixels[numberOfMethods]) {
+    const uint8 writeErr = exporter.record(path, errCode, w, h, metrics, brokenPixels);
+    if(writeErr != 0)
+        printError(writeErr);
 }
 
 /*!
- * \brief Поиск битых пикселей методом иерархий(реализовано для квадрата 5*5)
- * \param raster - массив пикселей
- * \param w - ширина изображения
- * \param npixels - количество пикселей
- * \param threshold - порог по которому будут отбираться искомые пиксели
- * \return Возвращается коллекция индексов пикселей отобранных алгоритмом.
+ * \brief Вывод битых пикселей, отобранных по накопленной статистике кадров: таблицей в консоль или в файл выбранного формата.
+ * В текстовых форматах для каждого пикселя выводятся число кадров с попаданием, средний остаток и его СКО.
+ * \param temporal - статистика последовательности кадров
+ * \param threshold - порог среднего остатка
+ * \param minHitRate - минимальная доля кадров с попаданием
+ * \param outputPath - путь к файлу результата (пустой - таблица в консоль)
+ * \param format - формат файла результата
  */
-QSet<size_t>* hierarchyBrokenPixelSearch(uint16* raster, uint32 w, size_t npixels, const uint16 threshold) {
-    /* Алгоритм подбирает подходящий цвет основываясь на сумме весовых коэффициентах 3-х критериев
-     *
-     * Критерий 1
-     * 1.Для каждого соседа вычисяется среднее значение его соседей без учета проверяемого
-     * 2.Считается отличие среднего значения каждого соседа от максимального значения цвета и переводится в значение диапазона [0,1]
-     * 3.Для каждого соседа вычисляется вес значений из п.2(значение делится на сумму всех значений)
-     *
-     * Критерий 2
-     * 1.Для каждого соседа вычисляется количество пикселей такого же цвета без учета проверяемого
-     * 2.Для каждого соседа вычисляется вес значений и п.1(значение делится на сумму всех значений)
-     *
-     * Критерий 3
-     * 1.Для каждой пары противоположных соседей считается разница значений цветов
-     * 2.Считается отличие разницы значений каждой пары от максимального значения цвета и переводится в значение диапазона [0,1]
-     * 3.Для каждого соседа вычисляется вес значений из п.2(значение делится на сумму всех значений)
-     */
-
-    /* Для оптимизации, алгоритм был преобразован следующим образом:
-     * К1: Т.к. среднее значение окружающих пикселей может использоваться до 8 раз,
-     * сначала считаются суммы окружающих пикселей для каждого пикселя изображения(исключая полосу в 1 пиксель по краям изображения).
-     * Таким образом для вычисления ср. знач. достаточно вычесть значение исключаемого пикселя и поделить на 7.
-     * Вес среднего значения отличия пикселя от максимального значения цвета(мзц) - это отношение разницы мзц и среднего значения пикселя к разнице мзц*7 и суммы средних значений всех соседей.
-     * Умножение на 7 получается из суммы отличий всех пикселей(всего окружающих пикселей 8), кроме проверяемого пикселя.
-     *
-     * К2: Т.к. количество соседей такого же пикселя может использоваться до 8 раз,
-     * сначала считается количество таких же пикселей среди соседей для каждого пикселя изображения(исключая полосу в 1 пиксель по краям изображения).
-     * Вес количества похожих пикселей расчитывается как отношение этого значения для соседнего пикселя к сумме значений всех соседей.
-     *
-     * К3: Разница противоположных пикселей вычисляется 4 раза - для каждой пары.
-     * Значение суммы увеличивается в 2 раза т.к. для корректной работы разница должна быть высчитана для всех 8 пикселей
-     * Вес расчитывается как отношение разницы мзц и отличия пикселей в паре к сумме отличий.
-     */
-    QSet<size_t>* brokenPixels = new QSet<size_t>;
-    /* Смещения индекса пикселя для выбора соседних пикселей
-     * 0 - текущий пиксель (на индекс которого указывает переменная итератор)
-     * p - пиксель со значением которого будет производится сравнение
-     * 5 6 7
-     * 3 p 4
-     * 0 1 2
-     */
-    size_t adjacentPositions[8] = {0, 1, 2, w, w+2, 2*w, 2*w+1, 2*w+2};
-    size_t comparedPixel = w+1;// Смещение для проверяемого пикселя(центрального в квадрате 3*3)
-    uint32* sumsRaster = new uint32[npixels]; // Суммы соседних пикселей для каждого пикселя
-    uint8* samePixels = new uint8[npixels]; // Количество соседних пикселей того же цвета для каждого пикселя
+void printTemporalDefects(const TemporalMap& temporal, const uint16 threshold, double minHitRate, const string& outputPath, OutputFormat format) {
+    static const char* names[] = {"hits", "mean", "std"};
+    static const char* titles[] = {"Hits", "Mean", "Std dev"};
+    static const uint8 widths[] = {9, 12, 12};
+    PixelColumns columns = {3, names, titles, widths, [&temporal](size_t el, double* values) {
+        values[0] = temporal.hitCount(el);
+        values[1] = temporal.meanResidual(el);
+        values[2] = sqrt(temporal.variance(el));
+    }};
+    // Отобранные пиксели не делятся по методам и в двоичном формате и масках отмечаются битом 0
+    DefectMap* defects[numberOfMethods] = {temporal.classify(threshold, minHitRate)};
+    cout << "Frames: " << temporal.frames() << endl;
+    const uint8 errCode = writeDefects(outputPath.empty() ? "-" : outputPath, outputPath.empty() ? OUTPUT_TABLE : format,
+                                       defects, temporal.width(), temporal.height(), &columns);
+    if(errCode != 0)
+        printError(errCode);
+    else if(!outputPath.empty())
+        cout << "Saved to: " << outputPath << endl;
+    delete defects[0];
+}
 
-    // Предварительный этап
-    // 1.Вычисляются суммы соседей и количество таких же пикселей для всего изображения, исключая полосы в 1 пиксель по краям изображения
-    for(size_t i = 0; i < npixels - 2*w-2; i++) {
-        if(!(i%w < w-2)) // Исключаем выход квадрата за пределы изображения
-            continue;
-        sumsRaster[i + comparedPixel] = 0;
-        samePixels[i + comparedPixel] = 0;
-        for(uint8 pos = 0; pos < 8; pos++) {
-            //Вычисляем сумму всех соседей для текущего центрального пикселя квадрата
-            sumsRaster[i + comparedPixel] += raster[i + adjacentPositions[pos]];
-            //Считаем количество всех соседей имеющих такое же значение цвета для текущего центрального пикселя квадрата
-            if(raster[i + comparedPixel] == raster[i + adjacentPositions[pos]])
-                samePixels[i + comparedPixel]++;
+/*!
+ * \brief Поиск битых пикселей в одном изображении с пикселями типа Pixel.
+ * Изображение читается построчно, обрабатывается прямо в отображённой памяти (если файл несжатый)
+ * или декодируется целиком.
+ * \param path - Путь до изображения
+ * \param stream - читать изображение построчно
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param pool - пул потоков
+ * \param temporal - статистика кадров, к которой добавляется изображение (nullptr - не накапливать)
+ * \param brokenPixels - результаты методов
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param milliseconds - время поиска битых пикселей
+ * \param metrics - показатели обработки (nullptr - без замеров)
+ * \return В случае успеха вернёт 0, иначе код ошибки getImage или TemporalMap
+ */
+template<typename Pixel>
+uint8 searchImage(const char* path, bool stream, const uint16 threshold, uint8 methods, ThreadPool& pool, TemporalMap* temporal,
+                  DefectMap* brokenPixels[numberOfMethods], uint32& w, uint32& h, double& milliseconds, FrameMetrics* metrics) {
+    chrono::steady_clock::time_point start, end;
+    Pixel* raster = nullptr;
+    size_t npixels = 0;
+    uint8 errCode;
+    BasicMappedImage<Pixel> mapped;
+    BasicRasterRows<Pixel> rows = {nullptr, 0, 0};
+    if(stream) {
+        // В памяти держится только окно из нескольких полос строк
+        BasicScanlineReader<Pixel> reader;
+        errCode = reader.open(path);
+        if(errCode == 0) {
+            w = reader.width();
+            h = reader.height();
+            start = chrono::steady_clock::now();
+            const bool ok = streamingBrokenPixelSearch<Pixel>(w, h, [&reader, metrics](Pixel* dst, size_t count) {
+                StageTimer timer(metrics, STAGE_DECODE);
+                return reader.readRows(dst, uint32(count)) == 0;
+            }, threshold, methods, brokenPixels, &pool, metrics);
+            end = chrono::steady_clock::now();
+            if(metrics)
+                metrics->bytesDecoded += reader.decodedBytes();
+            if(!ok)
+                errCode = 5;
         }
     }
-    // 2.Задаются константы мзц для одного значения, 7 (при вычислении сыммых средних), 4 (при вычислении суммы разниц)
-    const uint32 M = 0xffff, avgM = M*7, diffM = M*4;
-
-    double avgNeighborPixel[8]; // Средние значения окружающих пикселей, исключая проверяемый, для 8 пикселей соседей
-    double sumAvgNeighborPixels; // Сумма средних значений соседних пикселей
-    size_t checkingPos, oppositeCheckingPos; // Позиция обрабатываемого соседнего пикселя; позиция потивоположного checkingPos пикселя относительно центрального
-    double P[8]; // Веса пикселей (общий, по критерию 1)
-
-    double samePixelsSum; // Сумма значений для соседних пикселей из массива samePixels
-    double V[8]; // Веса пикселей (по критерию 2)
-
-    uint16 diffOppositePixels[4]; // Разница противолежащих пикселей
-    double sumDiffs; // Сумма разниц
-    double W[8]; // Веса пикселей (по критерию 3)
-
-    // Итерация изображения по строкам до w-2 и до h-2 по столбцам
-    for(size_t i = 0; i < npixels - 2*w-2; i++){
-        if(!(i%w < w-2)) // Если итератор вошёл в отступы строки - пропускаем(исключаем выход квадрата за пределы изображения)
-            continue;
-        for(uint8 a = 0; a < 8; a++){
-            P[a] = 0;
-            V[a] = 0;
-            W[a] = 0;
+    else if(mapped.open(path)) {
+        // Несжатый файл обрабатывается прямо в отображённой памяти без копирования
+        w = mapped.width();
+        h = mapped.height();
+        rows = {mapped.data(), mapped.stride(), 0};
+        errCode = 0;
+        start = chrono::steady_clock::now();
+        if(temporal)
+            errCode = accumulatingSearch(rows, w, h, threshold, methods, brokenPixels, *temporal, &pool, metrics);
+        else
+            fusedBrokenPixelSearch(rows, w, h, threshold, methods, brokenPixels, &pool, metrics);
+        end = chrono::steady_clock::now();
+    }
+    else {
+        {
+            StageTimer timer(metrics, STAGE_DECODE);
+            errCode = getImage(path, raster, w, h, npixels, &pool);
         }
-
-        // Для вычисления сумм отличий от мзц из суммы мзц будем вычитать значения для каждого соседа
-        sumAvgNeighborPixels = avgM;
-        samePixelsSum = 0;
-        sumDiffs = diffM;
-        // Составление массива значений и их сумм для каждого критерия
-        for(uint8 dir = 0; dir < 8; dir++){
-            // Смещение для текущего обрабатываемого соседа
-            checkingPos = i + adjacentPositions[dir];
-            // Вычисление среднего значения для соседей, исключая проверяемый пиксель
-            avgNeighborPixel[dir] = (sumsRaster[checkingPos] - raster[i + comparedPixel]) / 7.0;
-            sumAvgNeighborPixels -= avgNeighborPixel[dir];
-            // Вычисляем количество похожих пикселей из окружения
-            if(samePixels[i + adjacentPositions[dir]] != 0){
-                // Если значение проверяемого пикселя учлось, то исключаем его из общего количества
-                V[dir] = raster[i + comparedPixel] == raster[checkingPos] ? samePixels[i + adjacentPositions[dir]] - 1 : samePixels[i + adjacentPositions[dir]];
-                samePixelsSum += V[dir];
-            }
-            // Вычисляем отличие для пар противоположных пикселей
-            if(dir < 4) {
-                // Смещение для противоположного соседа
-                oppositeCheckingPos = i + adjacentPositions[7 - dir];
-                // Вычисление модуля разницы пикселей в паре
-                if(raster[checkingPos] > raster[oppositeCheckingPos]) {
-                    diffOppositePixels[dir] = raster[checkingPos] - raster[oppositeCheckingPos];
-                    sumDiffs -= diffOppositePixels[dir];
-                }
-                else {
-                    diffOppositePixels[dir] = raster[oppositeCheckingPos] - raster[checkingPos];
-                    sumDiffs -= diffOppositePixels[dir];
-                }
-            }
-        }
-        // Получаем сумму для 8 соседей
-        sumDiffs *= 2;
-        // Расчитываем веса
-        for(uint8 dir = 0; dir < 8; dir++) {
-            // Вес по критерию 1
-            P[dir] += (M - avgNeighborPixel[dir]) / sumAvgNeighborPixels;
-            // Вес по критерию 2
-            if(V[dir] != 0){
-                P[dir] += V[dir] / samePixelsSum;
-            }
-            // Вес по критерию 3
-            if(dir < 4) {
-                W[dir] = (M - diffOppositePixels[dir]) / sumDiffs;
-                P[dir] += W[dir];
-                // Т.к значения весов одинаковы для пикселей в паре, добавляем такой же вес противоположному пикселю
-                P[7 - dir] += W[dir];
-            }
+        rows = {raster, w, 0};
+        if(errCode == 0) {
+            if(metrics)
+                metrics->bytesDecoded += npixels * sizeof(Pixel);
+            start = chrono::steady_clock::now();
+            if(temporal)
+                errCode = accumulatingSearch(rows, w, h, threshold, methods, brokenPixels, *temporal, &pool, metrics);
+            else
+                fusedBrokenPixelSearch(raster, w, npixels, threshold, methods, brokenPixels, &pool, metrics);
+            end = chrono::steady_clock::now();
         }
+    }
+    milliseconds = chrono::duration<double, milli>(end - start).count();
+    if(metrics)
+        metrics->stageNs[STAGE_DETECT] += uint64(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+    delete[] raster;
+    return errCode;
+}
 
-        // Если отличие превышает заданный порог, то индекс пикселя помещается в коллекцию
-        if(isExceedThreshold(int32(raster[i + comparedPixel]) - int32(raster[i + adjacentPositions[max_element(P, P+8) - P]]), threshold)) {
-            *brokenPixels << i + comparedPixel;
-        }
+/*!
+ * \brief Повторная проверка известных битых пикселей в изображении с пикселями типа Pixel.
+ * Несжатый файл проверяется прямо в отображённой памяти, остальные читаются построчно,
+ * причём декодируются только полосы с окрестностями проверяемых пикселей.
+ * \param path - Путь до изображения
+ * \param listPath - Путь до списка пикселей (см. readDefectList)
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - результаты методов: пиксели списка, которые по-прежнему отбираются
+ * \param known - количество пикселей в списке
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param milliseconds - время проверки
+ * \param metrics - показатели обработки (nullptr - без замеров)
+ * \return В случае успеха вернёт 0, иначе код ошибки getImage или 7 (не удалось прочитать список)
+ */
+template<typename Pixel>
+uint8 verifyImage(const char* path, const string& listPath, const uint16 threshold, uint8 methods,
+                  DefectMap* brokenPixels[numberOfMethods], size_t& known, uint32& w, uint32& h, double& milliseconds,
+                  FrameMetrics* metrics) {
+    BasicMappedImage<Pixel> mapped;
+    BasicScanlineReader<Pixel> reader;
+    // Проверяются только окрестности пикселей списка, упреждающее чтение всего файла не нужно
+    const bool isMapped = mapped.open(path, ACCESS_RANDOM);
+    if(isMapped) {
+        w = mapped.width();
+        h = mapped.height();
     }
+    else {
+        const uint8 errCode = reader.open(path);
+        if(errCode != 0)
+            return errCode;
+        w = reader.width();
+        h = reader.height();
+    }
+    DefectMap list;
+    if(!readDefectList(listPath, w, h, list))
+        return 7;
+    known = list.count();
 
-    // delete
-    delete[] sumsRaster;
-    delete[] samePixels;
-    return brokenPixels;
+    uint8 errCode = 0;
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if(isMapped) {
+        const BasicRasterRows<Pixel> rows = {mapped.data(), mapped.stride(), 0};
+        verifyBrokenPixels(rows, w, h, list, threshold, methods, brokenPixels);
+    }
+    else if(!verifyBrokenPixels<Pixel>(w, h, [&reader, metrics](Pixel* dst, size_t first, size_t count) {
+                StageTimer timer(metrics, STAGE_DECODE);
+                return reader.seek(uint32(first)) == 0 && reader.readRows(dst, uint32(count)) == 0;
+            }, list, threshold, methods, brokenPixels))
+        errCode = 5;
+    const uint64 ns = elapsedNanoseconds(start);
+    milliseconds = ns / 1e6;
+    if(metrics) {
+        metrics->stageNs[STAGE_DETECT] += ns;
+        metrics->bytesDecoded += reader.decodedBytes();
+        metrics->pixelsScanned += known;
+    }
+    return errCode;
 }
 
-
 int main(int argc, char* argv[])
 {
     char* path;
     uint16 threshold;
-    if(argc != 3) {
-        cout << "Enter path to img and threshold as a percentage\nExample: \"img.tif\" 25" << endl;
+    uint8 methods = METHOD_ALL;
+    unsigned threads = 0;
+    bool stream = false;
+    bool classify = false;
+    bool cascade = false;
+    bool watch = false;
+    string accumulatePath;
+    string verifyPath;
+    string outputPath;
+    string metricsPath;
+    OutputFormat format = OUTPUT_TABLE;
+    bool formatSet = false;
+    double minHitRate = 0.5;
+    if(argc < 3) {
+        cout << "Enter path to img and threshold as a percentage\nExample: \"img.tif\" 25\n"
+                "The path may also be a folder, a name pattern like \"frames/*.tif\" or a list file \"@list.txt\"\n"
+                "Options:\n"
+                "  --methods avg3,avg5,median3,hierarchy3  methods to run (all by default)\n"
+                "  --threads N                             number of threads (all cores by default)\n"
+                "  --stream                                read the image row by row instead of loading it whole\n"
+                "  --cascade                               run hierarchy3 only on pixels that differ from a neighbour by more than the threshold\n"
+                "  --watch                                 the path is a folder: keep running and process each image once it is fully written\n"
+                "  --verify FILE                           check only the pixels listed in FILE (\"x y\" or \"(x;y)\" per line, or a map file)\n"
+                "  --output FILE                           write the result to FILE instead of the console (a folder for a set of images)\n"
+                "  --format NAME                           table, csv, json, binary, mask8, mask1 or map (by the --output extension by default)\n"
+                "  --metrics FILE                          append per-frame timings and counters to FILE as JSON lines (Prometheus text if FILE ends with .prom)\n"
+                "  --accumulate FILE                       add the frames to the per-pixel statistics in FILE\n"
+                "  --classify                              the path is a statistics file: print or --output pixels broken across frames (save a .bpm map to --verify later frames)\n"
+                "  --min-hits PERCENT                      share of frames a pixel must be found in to be broken (50 by default)" << endl;
         return 0;
     }
     else {
         path = argv[1];
-        string str = argv[2];
-        for(auto i : str) {
-            if(!isdigit(i)) {
-                cout << "Error: threshold is number" << endl;
-                return 0;
-            }
+        if(!isNumber(argv[2])) {
+            cout << "Error: threshold is number" << endl;
+            return 0;
         }
         if(atof(argv[2]) > 0 && atof(argv[2]) < 100)
             threshold = 0xffff * (atoi(argv[2]) / 100.0);
@@ -388,86 +346,228 @@ int main(int argc, char* argv[])
             cout << "Error: threshold shoud be between 0 and 100" << endl;
             return 0;
         }
+        for(int i = 3; i < argc; i++) {
+            const string option = argv[i];
+            if(option == "--stream") {
+                stream = true;
+                continue;
+            }
+            if(option == "--classify") {
+                classify = true;
+                continue;
+            }
+            if(option == "--cascade") {
+                cascade = true;
+                continue;
+            }
+            if(option == "--watch") {
+                watch = true;
+                continue;
+            }
+            if(i + 1 >= argc) {
+                cout << "Error: option " << option << " requires a value" << endl;
+                return 0;
+            }
+            const string value = argv[++i];
+            if(option == "--methods") {
+                if(!parseMethods(value, methods)) {
+                    cout << "Error: unknown methods, expected a list of avg3, avg5, median3, hierarchy3" << endl;
+                    return 0;
+                }
+            }
+            else if(option == "--threads") {
+                if(!isNumber(value) || atoi(value.c_str()) < 1) {
+                    cout << "Error: number of threads should be a positive number" << endl;
+                    return 0;
+                }
+                threads = atoi(value.c_str());
+            }
+            else if(option == "--accumulate")
+                accumulatePath = value;
+            else if(option == "--verify")
+                verifyPath = value;
+            else if(option == "--output")
+                outputPath = value;
+            else if(option == "--metrics")
+                metricsPath = value;
+            else if(option == "--format") {
+                if(!parseOutputFormat(value, format)) {
+                    cout << "Error: unknown format, expected table, csv, json, binary, mask8, mask1 or map" << endl;
+                    return 0;
+                }
+                formatSet = true;
+            }
+            else if(option == "--min-hits") {
+                if(!isNumber(value) || atoi(value.c_str()) < 1 || atoi(value.c_str()) > 100) {
+                    cout << "Error: --min-hits should be between 1 and 100" << endl;
+                    return 0;
+                }
+                minHitRate = atoi(value.c_str()) / 100.0;
+            }
+            else {
+                cout << "Error: unknown option " << option << endl;
+                return 0;
+            }
+        }
+    }
+    if(cascade)
+        methods |= SEARCH_CASCADE;
+    if(!outputPath.empty() && !formatSet)
+        format = watch || isBatchSpec(path) ? OUTPUT_CSV : outputFormatOf(outputPath);
+    ThreadPool pool(threads);
+    MetricsExporter exporter;
+    if(!metricsPath.empty() && !exporter.open(metricsPath)) {
+        printError(8);
+        return 0;
     }
-    time_t start, end;
-
-    uint16* raster = nullptr; uint32 w = 0, h = 0; size_t npixels = 0;
-    uint8 numberOfMethods = 4;
-    QSet<size_t>** brokenPixels = new QSet<size_t>*[numberOfMethods]{nullptr};
-    QSet<size_t> resultBrokenPixelsSet;
-
-    uint8 errCode = getImage(path, raster, w, h, npixels);
-    if(errCode == 0) {
-        start = clock();
-        brokenPixels[0] = avgBrokenPixelSearch(raster, w, npixels, threshold, 3);
-        end = clock();
-        cout << "avg3 milliseconds: " << end - start << endl;
-
-        start = clock();
-        brokenPixels[1] = avgBrokenPixelSearch(raster, w, npixels, threshold, 5);
-        end = clock();
-        cout << "avg5 milliseconds: " << end - start << endl;
-
-        start = clock();
-        brokenPixels[2] = medianBrokenPixelSearch(raster, w, npixels, threshold);
-        end = clock();
-        cout << "median3 milliseconds: " << end - start << endl;
 
-        start = clock();
-        brokenPixels[3] = hierarchyBrokenPixelSearch(raster, w, npixels, threshold);
-        end = clock();
-        cout << "hierarchy3 milliseconds: " << end - start << endl;
+    if(classify) {
+        // Классификация по сохранённой статистике без анализа кадров
+        TemporalMap temporal;
+        const uint8 errCode = temporal.load(path);
+        if(errCode == 0)
+            printTemporalDefects(temporal, threshold, minHitRate, outputPath, format);
+        else
+            printError(errCode);
+        return 0;
+    }
+    if(watch && (stream || !verifyPath.empty())) {
+        cout << "Error: --watch is not supported with --stream or --verify" << endl;
+        return 0;
+    }
+    if(!verifyPath.empty() && (!accumulatePath.empty() || isBatchSpec(path))) {
+        cout << "Error: --verify is supported only for a single image without --accumulate" << endl;
+        return 0;
+    }
+    if(stream && !verifyPath.empty()) {
+        cout << "Error: --verify is not supported with --stream" << endl;
+        return 0;
+    }
+    if(stream && !accumulatePath.empty()) {
+        cout << "Error: --accumulate is not supported with --stream" << endl;
+        return 0;
+    }
+    if(!outputPath.empty() && (watch || isBatchSpec(path))) {
+        // Результаты набора кадров пишутся в папку, которой может ещё не быть
+        error_code ec;
+        filesystem::create_directories(outputPath, ec);
+        if(ec || !filesystem::is_directory(outputPath, ec)) {
+            cout << "Error: couldn't create the output folder " << outputPath << endl;
+            return 0;
+        }
+    }
+    TemporalMap temporal;
+    if(!accumulatePath.empty()) {
+        const uint8 errCode = temporal.open(accumulatePath.c_str());
+        if(errCode != 0) {
+            printError(errCode);
+            return 0;
+        }
+    }
 
-        for(uint8 method = 0; method < numberOfMethods; method++) {
-            resultBrokenPixelsSet.unite(*(brokenPixels[method]));
+    // Вывод результатов кадра набора, вызывается конвейером по кадрам
+    auto emitFrame = [&outputPath, format, &exporter](Frame& frame) {
+        cout << "File: " << frame.path << endl;
+        if(frame.errCode == 0) {
+            cout << "all methods milliseconds: " << frame.milliseconds << endl;
+            StageTimer timer(exporter.isOpen() ? &frame.metrics : nullptr, STAGE_OUTPUT);
+            printBrokenPixels(frame.brokenPixels, frame.w, frame.h,
+                              outputPath.empty() ? outputPath : frameOutputPath(outputPath, frame.path, format), format);
+        }
+        else
+            printError(frame.errCode);
+        if(exporter.isOpen())
+            recordMetrics(exporter, frame.path, frame.errCode, frame.w, frame.h, frame.metrics, frame.brokenPixels);
+    };
+    TemporalMap* accumulateTo = accumulatePath.empty() ? nullptr : &temporal;
+
+    if(watch) {
+        /* Папка наблюдается до SIGINT или SIGTERM. Пул потоков и кадры конвейера с буферами растра
+         * живут всё это время, поэтому время кадра складывается только из декодирования и поиска.
+         */
+        DirectoryWatcher watcher;
+        if(!watcher.open(path)) {
+            cout << "Error: couldn't watch the folder (a folder on Linux is required)" << endl;
+            return 0;
         }
-        QList<size_t> outputList(resultBrokenPixelsSet.begin(), resultBrokenPixelsSet.end());
-        sort(outputList.begin(), outputList.end());
+        activeWatcher = &watcher;
+        signal(SIGINT, stopWatching);
+        signal(SIGTERM, stopWatching);
+        cout << "Watching: " << path << endl;
+        runPipeline([&watcher](string& framePath) { return watcher.next(framePath); },
+                    threshold, methods, pool, emitFrame, accumulateTo, exporter.isOpen());
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        activeWatcher = nullptr;
+        return 0;
+    }
 
-        cout << "Pixels total: " << outputList.count() << endl;
-        cout << setw(11) << setfill(' ') << "(w;h)";
-        for(uint8 method = 0; method < numberOfMethods; method++) {
-            cout << setw(9) << setfill(' ') << "Method " + to_string(method);
+    if(isBatchSpec(path)) {
+        // Набор кадров обрабатывается конвейером, результаты выводятся по кадрам
+        if(stream) {
+            cout << "Error: --stream is not supported for a set of images" << endl;
+            return 0;
         }
-        cout << endl;
-        double counter;
-        for(auto el: outputList){
-            cout << setw(11) << setfill(' ') << "(" + to_string(el%w) + ";" + to_string(el/w) + ")";
-            counter = 0;
-            for(uint8 method = 0; method < numberOfMethods; method++) {
-                if(brokenPixels[method]->contains(el)){
-                    counter++;
-                    cout << setw(9) << setfill(' ') << "True";
-                }
-                else {
-                    cout << setw(9) << setfill(' ') << "False";
-                }
-            }
-            cout << "  " << counter/numberOfMethods*100 << "%" << endl;
+        vector<string> paths;
+        if(!listFrames(path, paths)) {
+            cout << "Error: couldn't read the list of images" << endl;
+            return 0;
         }
+        runBatch(paths, threshold, methods, pool, emitFrame, accumulateTo, exporter.isOpen());
+        return 0;
     }
-    else {
-        switch (errCode) {
-        case 1:
-            cout << "Error: couldn't open the file" << endl;
+
+    uint32 w = 0, h = 0;
+    double milliseconds = 0;
+    DefectMap** brokenPixels = new DefectMap*[numberOfMethods]{nullptr};
+    FrameMetrics frameMetrics;
+    FrameMetrics* metrics = exporter.isOpen() ? &frameMetrics : nullptr;
+
+    // Детекторы и загрузчик специализированы под тип пикселей файла
+    PixelType type;
+    uint8 errCode = getPixelType(path, type);
+    if(errCode == 0 && !verifyPath.empty()) {
+        size_t known = 0;
+        switch(type) {
+        case PIXEL_UINT8:
+            errCode = verifyImage<uint8>(path, verifyPath, threshold, methods, brokenPixels, known, w, h, milliseconds, metrics);
             break;
-        case 2:
-            cout << "Error: image configuration is not supported" << endl;
+        case PIXEL_UINT16:
+            errCode = verifyImage<uint16>(path, verifyPath, threshold, methods, brokenPixels, known, w, h, milliseconds, metrics);
             break;
-        case 3:
-            cout << "Error: image is too small" << endl;
+        case PIXEL_FLOAT:
+            errCode = verifyImage<float>(path, verifyPath, threshold, methods, brokenPixels, known, w, h, milliseconds, metrics);
+            break;
+        }
+        if(errCode == 0)
+            cout << "Known pixels: " << known << endl;
+    }
+    else if(errCode == 0) {
+        switch(type) {
+        case PIXEL_UINT8:
+            errCode = searchImage<uint8>(path, stream, threshold, methods, pool, accumulateTo, brokenPixels, w, h, milliseconds,
+                                         metrics);
             break;
-        case 4:
-            cout << "Error: failed to allocate memory" << endl;
+        case PIXEL_UINT16:
+            errCode = searchImage<uint16>(path, stream, threshold, methods, pool, accumulateTo, brokenPixels, w, h, milliseconds,
+                                         metrics);
             break;
-        case 5:
-            cout << "Error: couldn't read the image" << endl;
+        case PIXEL_FLOAT:
+            errCode = searchImage<float>(path, stream, threshold, methods, pool, accumulateTo, brokenPixels, w, h, milliseconds,
+                                         metrics);
             break;
         }
     }
+    if(errCode == 0) {
+        cout << "all methods milliseconds: " << milliseconds << endl;
+        StageTimer timer(metrics, STAGE_OUTPUT);
+        printBrokenPixels(brokenPixels, w, h, outputPath, format);
+    }
+    else
+        printError(errCode);
+    if(metrics)
+        recordMetrics(exporter, path, errCode, w, h, frameMetrics, brokenPixels);
 
-    delete path;
-    delete[] raster;
     for(uint8 i = 0; i < numberOfMethods; i++)
         delete brokenPixels[i];
     delete[] brokenPixels;
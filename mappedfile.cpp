@@ -0,0 +1,113 @@
+#include "mappedfile.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+/*!
+ * \brief Отображение существующего файла
+ * \param path - Путь до файла
+ * \param writable - отображение для записи (изменения попадают в файл)
+ * \param access - ожидаемый порядок чтения
+ * \return В случае успеха вернёт true, иначе false
+ */
+bool MappedFile::open(const char* path, bool writable, FileAccess access) {
+    return map(path, writable, 0, access);
+}
+
+/*!
+ * \brief Создание (или перезапись) файла заданного размера, заполненного нулями, и отображение его для записи
+ * \param path - Путь до файла
+ * \param size - размер файла в байтах
+ * \return В случае успеха вернёт true, иначе false
+ */
+bool MappedFile::create(const char* path, size_t size) {
+    return size > 0 && map(path, true, size, ACCESS_SEQUENTIAL);
+}
+
+/*!
+ * \brief Открытие и отображение файла
+ * \param path - Путь до файла
+ * \param writable - отображение для записи
+ * \param newSize - размер создаваемого файла, 0 - открыть существующий
+ * \param access - ожидаемый порядок чтения
+ * \return В случае успеха вернёт true, иначе false
+ */
+bool MappedFile::map(const char* path, bool writable, size_t newSize, FileAccess access) {
+    close();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL,
+                              newSize ? CREATE_ALWAYS : OPEN_EXISTING,
+                              access == ACCESS_RANDOM ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    fileSize.QuadPart = LONGLONG(newSize);
+    if(newSize == 0 && !GetFileSizeEx(file, &fileSize))
+        fileSize.QuadPart = 0;
+    if(fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                 DWORD(fileSize.QuadPart >> 32), DWORD(fileSize.QuadPart), NULL);
+    CloseHandle(file);
+    if(!mapping)
+        return false;
+    view = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+    if(!view) {
+        close();
+        return false;
+    }
+    viewSize = size_t(fileSize.QuadPart);
+#else
+    const int fd = newSize ? ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(path, writable ? O_RDWR : O_RDONLY);
+    if(fd == -1)
+        return false;
+    struct stat st;
+    if(newSize) {
+        if(ftruncate(fd, off_t(newSize)) != 0) {
+            ::close(fd);
+            return false;
+        }
+        st.st_size = off_t(newSize);
+    }
+    else if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    view = mmap(nullptr, size_t(st.st_size), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(view == MAP_FAILED) {
+        view = nullptr;
+        return false;
+    }
+    viewSize = size_t(st.st_size);
+    madvise(view, viewSize, access == ACCESS_RANDOM ? MADV_RANDOM : MADV_SEQUENTIAL);
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#if defined(_WIN32)
+    if(view)
+        UnmapViewOfFile(view);
+    if(mapping)
+        CloseHandle(mapping);
+    mapping = nullptr;
+#else
+    if(view)
+        munmap(view, viewSize);
+#endif
+    view = nullptr;
+    viewSize = 0;
+}
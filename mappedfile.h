@@ -0,0 +1,43 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+
+/*!
+ * \brief Ожидаемый порядок чтения отображённого файла - подсказка ОС для упреждающего чтения
+ */
+enum FileAccess {
+    ACCESS_SEQUENTIAL = 0, // Файл читается от начала к концу: страницы читаются наперёд
+    ACCESS_RANDOM = 1      // Читаются отдельные места файла: наперёд читать незачем
+};
+
+/*!
+ * \brief Файл, отображённый в память целиком (mmap или CreateFileMapping в Windows)
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path, bool writable = false, FileAccess access = ACCESS_SEQUENTIAL);
+    bool create(const char* path, size_t size);
+    void close();
+
+    bool isOpen() const { return view != nullptr; }
+    void* data() const { return view; }
+    size_t size() const { return viewSize; }
+
+private:
+    bool map(const char* path, bool writable, size_t newSize, FileAccess access);
+
+    void* view = nullptr;
+    size_t viewSize = 0;
+#if defined(_WIN32)
+    void* mapping = nullptr;
+#endif
+};
+
+#endif // MAPPEDFILE_H
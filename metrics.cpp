@@ -0,0 +1,197 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cstdio>
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+using namespace std;
+
+const char* const stageNames[numberOfStages] = {"decode", "detect", "merge", "accumulate", "output"};
+const char* const stepNames[numberOfSteps] = {"precompute", "prefilter", "avg3", "avg5", "median3", "hierarchy3"};
+
+namespace {
+
+// Запись строки в кавычках JSON с экранированием служебных символов
+void putJsonString(FILE* file, const string& str) {
+    fputc('"', file);
+    for(char c : str) {
+        if(c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if(uint8(c) < 0x20)
+            fprintf(file, "\\u%04x", unsigned(uint8(c)));
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+double toMilliseconds(uint64 ns) {
+    return ns / 1e6;
+}
+
+// Замена файла target файлом source. rename() в Windows не заменяет существующий файл.
+bool replaceFile(const string& source, const string& target) {
+#if defined(_WIN32)
+    return MoveFileExA(source.c_str(), target.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(source.c_str(), target.c_str()) == 0;
+#endif
+}
+
+} // namespace
+
+void FrameMetrics::reset() {
+    for(auto& ns : stageNs)
+        ns = 0;
+    for(auto& ns : stepNs)
+        ns = 0;
+    bytesDecoded = 0;
+    pixelsScanned = 0;
+    candidates = 0;
+    denseRows = 0;
+    scratchBytes = 0;
+    scratchPeak = 0;
+}
+
+void FrameMetrics::allocate(uint64 bytes) {
+    const uint64 now = scratchBytes += bytes;
+    uint64 peak = scratchPeak;
+    while(now > peak && !scratchPeak.compare_exchange_weak(peak, now)) {}
+}
+
+MetricsExporter::~MetricsExporter() {
+    if(lines)
+        fclose(lines);
+}
+
+/*!
+ * \brief Открытие файла показателей. Формат выбирается по расширению: .prom - Prometheus, остальные - JSON lines.
+ * \param path - путь к файлу
+ * \return В случае успеха вернёт true, иначе false
+ */
+bool MetricsExporter::open(const string& path) {
+    this->path = path;
+    prometheus = path.size() > 5 && path.compare(path.size() - 5, 5, ".prom") == 0;
+    if(prometheus)
+        return true;
+    lines = fopen(path.c_str(), "a");
+    if(!lines)
+        this->path.clear();
+    return lines != nullptr;
+}
+
+/*!
+ * \brief Запись показателей кадра
+ * \param file - путь к кадру
+ * \param errCode - код ошибки обработки кадра (0 - обработан)
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param metrics - показатели кадра
+ * \param brokenPixels - результаты методов (nullptr для невыбранных), из них берётся количество отобранных пикселей
+ * \return В случае успеха вернёт 0, иначе 8 (не удалось записать файл)
+ */
+uint8 MetricsExporter::record(const string& file, uint8 errCode, uint32 w, uint32 h, const FrameMetrics& metrics,
+                              const DefectMap* const brokenPixels[numberOfMethods]) {
+    uint64 frameFound[numberOfMethods] = {0};
+    for(uint8 m = 0; m < numberOfMethods; m++) {
+        if(errCode == 0 && brokenPixels[m] != nullptr)
+            frameFound[m] = brokenPixels[m]->count();
+    }
+
+    frames++;
+    errors += errCode != 0;
+    for(uint8 s = 0; s < numberOfStages; s++)
+        stageSeconds[s] += metrics.stageNs[s] / 1e9;
+    for(uint8 s = 0; s < numberOfSteps; s++)
+        stepSeconds[s] += metrics.stepNs[s] / 1e9;
+    bytesDecoded += metrics.bytesDecoded;
+    pixelsScanned += metrics.pixelsScanned;
+    candidates += metrics.candidates;
+    denseRows += metrics.denseRows;
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        found[m] += frameFound[m];
+    scratchPeak = max(scratchPeak, uint64(metrics.scratchPeak));
+    if(prometheus)
+        return writePrometheus(metrics);
+
+    fputs("{\"file\":", lines);
+    putJsonString(lines, file);
+    fprintf(lines, ",\"error\":%u,\"width\":%u,\"height\":%u,\"stages_ms\":{", unsigned(errCode), w, h);
+    for(uint8 s = 0; s < numberOfStages; s++)
+        fprintf(lines, "%s\"%s\":%.3f", s ? "," : "", stageNames[s], toMilliseconds(metrics.stageNs[s]));
+    fputs("},\"thread_ms\":{", lines);
+    for(uint8 s = 0; s < numberOfSteps; s++)
+        fprintf(lines, "%s\"%s\":%.3f", s ? "," : "", stepNames[s], toMilliseconds(metrics.stepNs[s]));
+    fprintf(lines, "},\"bytes_decoded\":%llu,\"pixels_scanned\":%llu,\"hierarchy_candidates\":%llu,\"dense_rows\":%llu,"
+                   "\"scratch_peak_bytes\":%llu,\"found\":{",
+            (unsigned long long)metrics.bytesDecoded, (unsigned long long)metrics.pixelsScanned,
+            (unsigned long long)metrics.candidates, (unsigned long long)metrics.denseRows,
+            (unsigned long long)metrics.scratchPeak);
+    bool first = true;
+    for(uint8 m = 0; m < numberOfMethods; m++) {
+        if(brokenPixels[m] == nullptr)
+            continue;
+        fprintf(lines, "%s\"%s\":%llu", first ? "" : ",", methodNames[m], (unsigned long long)frameFound[m]);
+        first = false;
+    }
+    fputs("}}\n", lines);
+    // Строка сбрасывается сразу, чтобы сборщики видели кадр до завершения пакета
+    return fflush(lines) == 0 && !ferror(lines) ? 0 : 8;
+}
+
+/*!
+ * \brief Перезапись файла Prometheus: счётчики с начала работы и время стадий последнего кадра.
+ * Файл пишется под временным именем и переименовывается, поэтому сборщик не прочитает его наполовину.
+ * \return В случае успеха вернёт 0, иначе 8
+ */
+uint8 MetricsExporter::writePrometheus(const FrameMetrics& metrics) {
+    const string temp = path + ".tmp";
+    FILE* file = fopen(temp.c_str(), "w");
+    if(!file)
+        return 8;
+    fputs("# HELP brokenpixels_frames_total Frames processed.\n"
+          "# TYPE brokenpixels_frames_total counter\n", file);
+    fprintf(file, "brokenpixels_frames_total %llu\n", (unsigned long long)frames);
+    fputs("# HELP brokenpixels_frame_errors_total Frames that failed to load or process.\n"
+          "# TYPE brokenpixels_frame_errors_total counter\n", file);
+    fprintf(file, "brokenpixels_frame_errors_total %llu\n", (unsigned long long)errors);
+    fputs("# HELP brokenpixels_stage_seconds_total Wall time per processing stage.\n"
+          "# TYPE brokenpixels_stage_seconds_total counter\n", file);
+    for(uint8 s = 0; s < numberOfStages; s++)
+        fprintf(file, "brokenpixels_stage_seconds_total{stage=\"%s\"} %.9g\n", stageNames[s], stageSeconds[s]);
+    fputs("# HELP brokenpixels_step_seconds_total Detector time per step, summed over threads.\n"
+          "# TYPE brokenpixels_step_seconds_total counter\n", file);
+    for(uint8 s = 0; s < numberOfSteps; s++)
+        fprintf(file, "brokenpixels_step_seconds_total{step=\"%s\"} %.9g\n", stepNames[s], stepSeconds[s]);
+    fputs("# HELP brokenpixels_decoded_bytes_total Decoded pixel bytes.\n"
+          "# TYPE brokenpixels_decoded_bytes_total counter\n", file);
+    fprintf(file, "brokenpixels_decoded_bytes_total %llu\n", (unsigned long long)bytesDecoded);
+    fputs("# HELP brokenpixels_scanned_pixels_total Pixels checked by the detectors.\n"
+          "# TYPE brokenpixels_scanned_pixels_total counter\n", file);
+    fprintf(file, "brokenpixels_scanned_pixels_total %llu\n", (unsigned long long)pixelsScanned);
+    fputs("# HELP brokenpixels_hierarchy_candidates_total Pixels evaluated by the hierarchy method.\n"
+          "# TYPE brokenpixels_hierarchy_candidates_total counter\n", file);
+    fprintf(file, "brokenpixels_hierarchy_candidates_total %llu\n", (unsigned long long)candidates);
+    fputs("# HELP brokenpixels_dense_rows_total Rows the cascade mode checked in full.\n"
+          "# TYPE brokenpixels_dense_rows_total counter\n", file);
+    fprintf(file, "brokenpixels_dense_rows_total %llu\n", (unsigned long long)denseRows);
+    fputs("# HELP brokenpixels_found_pixels_total Broken pixels found per method.\n"
+          "# TYPE brokenpixels_found_pixels_total counter\n", file);
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        fprintf(file, "brokenpixels_found_pixels_total{method=\"%s\"} %llu\n", methodNames[m], (unsigned long long)found[m]);
+    fputs("# HELP brokenpixels_scratch_peak_bytes Largest detector scratch allocation of a frame.\n"
+          "# TYPE brokenpixels_scratch_peak_bytes gauge\n", file);
+    fprintf(file, "brokenpixels_scratch_peak_bytes %llu\n", (unsigned long long)scratchPeak);
+    fputs("# HELP brokenpixels_last_frame_stage_seconds Wall time per stage of the last frame.\n"
+          "# TYPE brokenpixels_last_frame_stage_seconds gauge\n", file);
+    for(uint8 s = 0; s < numberOfStages; s++)
+        fprintf(file, "brokenpixels_last_frame_stage_seconds{stage=\"%s\"} %.9g\n", stageNames[s], metrics.stageNs[s] / 1e9);
+    const bool ok = !ferror(file);
+    if(fclose(file) != 0 || !ok || !replaceFile(temp, path)) {
+        remove(temp.c_str());
+        return 8;
+    }
+    return 0;
+}
@@ -0,0 +1,131 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include "detectors.h"
+
+/*!
+ * \brief Стадии обработки кадра, время которых измеряется по настенным часам
+ */
+enum MetricStage : uint8 {
+    STAGE_DECODE = 0,     // Чтение и декодирование изображения (при построчном чтении - суммарное время чтения строк)
+    STAGE_DETECT = 1,     // Поиск битых пикселей с объединением результатов полос (при построчном чтении - и с чтением)
+    STAGE_MERGE = 2,      // Объединение результатов полос (часть STAGE_DETECT)
+    STAGE_ACCUMULATE = 3, // Добавление кадра в статистику последовательности (остатки кадра считаются в STAGE_DETECT)
+    STAGE_OUTPUT = 4      // Вывод результатов
+};
+const uint8 numberOfStages = 5;
+
+/*!
+ * \brief Шаги построчного прохода детекторов (см. fusedRows). Время шагов суммируется по всем потокам.
+ */
+enum MetricStep : uint8 {
+    STEP_PRECOMPUTE = 0, // Суммы соседей 3*3 и количества совпадающих соседей кольцевого буфера
+    STEP_PREFILTER = 1,  // Отбор кандидатов метода иерархий в каскадном режиме
+    STEP_AVG3 = 2,
+    STEP_AVG5 = 3,
+    STEP_MEDIAN3 = 4,
+    STEP_HIERARCHY3 = 5
+};
+const uint8 numberOfSteps = 6;
+
+extern const char* const stageNames[numberOfStages];
+extern const char* const stepNames[numberOfSteps];
+
+// Наносекунды, прошедшие с момента start
+inline uint64 elapsedNanoseconds(std::chrono::steady_clock::time_point start) {
+    return uint64(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+/*!
+ * \brief Показатели обработки одного кадра.
+ * Счётчики атомарные, потому что их пополняют задачи пула потоков; задачи копят значения локально
+ * и добавляют их один раз на полосу, так что замеры почти не влияют на время работы.
+ * Детекторы получают указатель на показатели; nullptr отключает все замеры.
+ */
+struct FrameMetrics {
+    std::atomic<uint64> stageNs[numberOfStages];
+    std::atomic<uint64> stepNs[numberOfSteps];
+    std::atomic<uint64> bytesDecoded;    // Объём декодированных пикселей
+    std::atomic<uint64> pixelsScanned;   // Проверенные пиксели (без краёв изображения)
+    std::atomic<uint64> candidates;      // Пиксели, проверенные методом иерархий (в каскадном режиме - только кандидаты)
+    std::atomic<uint64> denseRows;       // Строки, которые каскадный режим проверил целиком
+    std::atomic<uint64> scratchBytes;    // Занятая рабочая память детекторов
+    std::atomic<uint64> scratchPeak;     // Наибольшая занятая рабочая память
+
+    FrameMetrics() { reset(); }
+    FrameMetrics(const FrameMetrics&) = delete;
+    FrameMetrics& operator=(const FrameMetrics&) = delete;
+
+    void reset();
+    // Учёт выделения и освобождения рабочих буферов
+    void allocate(uint64 bytes);
+    void release(uint64 bytes) { scratchBytes -= bytes; }
+};
+
+/*!
+ * \brief Замер времени стадии: время от создания до разрушения объекта добавляется к стадии.
+ * При metrics == nullptr ничего не делает.
+ */
+class StageTimer {
+public:
+    StageTimer(FrameMetrics* metrics, MetricStage stage) : metrics(metrics), stage(stage) {
+        if(metrics)
+            start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if(metrics)
+            metrics->stageNs[stage] += elapsedNanoseconds(start);
+    }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    FrameMetrics* metrics;
+    MetricStage stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+/*!
+ * \brief Выгрузка показателей кадров в файл.
+ * JSON lines (по строке на кадр, дописываются в конец файла) - чтобы находить медленные кадры;
+ * текстовый формат Prometheus (файл перезаписывается после каждого кадра накопленными счётчиками
+ * и значениями последнего кадра) - для сборщика textfile на машинах с установкой.
+ */
+class MetricsExporter {
+public:
+    MetricsExporter() = default;
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    bool open(const std::string& path);
+    uint8 record(const std::string& file, uint8 errCode, uint32 w, uint32 h, const FrameMetrics& metrics,
+                 const DefectMap* const brokenPixels[numberOfMethods]);
+    bool isOpen() const { return !path.empty(); }
+
+private:
+    uint8 writePrometheus(const FrameMetrics& metrics);
+
+    std::string path;
+    bool prometheus = false;
+    FILE* lines = nullptr; // Файл JSON lines
+    // Накопленные значения для формата Prometheus
+    uint64 frames = 0;
+    uint64 errors = 0;
+    double stageSeconds[numberOfStages] = {0};
+    double stepSeconds[numberOfSteps] = {0};
+    uint64 bytesDecoded = 0;
+    uint64 pixelsScanned = 0;
+    uint64 candidates = 0;
+    uint64 denseRows = 0;
+    uint64 found[numberOfMethods] = {0};
+    uint64 scratchPeak = 0;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,469 @@
+#include "output.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include "tiffio.h"
+
+using namespace std;
+
+namespace {
+
+const char magic[4] = {'B', 'P', 'D', 'L'};
+const uint32 version = 1;
+
+/*!
+ * \brief Буферизованная запись в файл большими блоками.
+ * Числа форматируются без iostream и printf, буфер сбрасывается в файл одним fwrite по заполнении.
+ */
+class BufferedWriter {
+public:
+    explicit BufferedWriter(FILE* file) : file(file), buffer(new char[capacity]) {}
+    ~BufferedWriter() { delete[] buffer; }
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    void put(char c) {
+        reserve(1);
+        buffer[size++] = c;
+    }
+    void put(const char* str, size_t len) {
+        if(len > capacity) {
+            flush();
+            ok = ok && fwrite(str, 1, len, file) == len;
+            return;
+        }
+        reserve(len);
+        memcpy(buffer + size, str, len);
+        size += len;
+    }
+    void put(const char* str) { put(str, strlen(str)); }
+    void putNumber(uint64 value) {
+        char digits[20];
+        size_t n = 0;
+        do {
+            digits[n++] = char('0' + value % 10);
+            value /= 10;
+        } while(value != 0);
+        reserve(n);
+        while(n > 0)
+            buffer[size++] = digits[--n];
+    }
+    // Строка, выровненная по правому краю поля шириной width (как setw)
+    void putRight(const char* str, size_t len, size_t width) {
+        reserve(max(len, width));
+        for(; width > len; width--)
+            buffer[size++] = ' ';
+        put(str, len);
+    }
+    void putRight(const char* str, size_t width) { putRight(str, strlen(str), width); }
+    void putBytes(const void* data, size_t len) { put(static_cast<const char*>(data), len); }
+
+    // Сброс буфера, возвращает false, если запись не удалась
+    bool flush() {
+        if(size > 0)
+            ok = ok && fwrite(buffer, 1, size, file) == size;
+        size = 0;
+        return ok;
+    }
+
+private:
+    void reserve(size_t n) {
+        if(size + n > capacity)
+            flush();
+    }
+
+    static const size_t capacity = 1 << 20;
+    FILE* file;
+    char* buffer;
+    size_t size = 0;
+    bool ok = true;
+};
+
+// Форматирование "(x;y)" в str, возвращает длину
+size_t formatPoint(char* str, size_t index, uint32 w) {
+    char* p = str;
+    *p++ = '(';
+    p += snprintf(p, 12, "%u", uint32(index % w));
+    *p++ = ';';
+    p += snprintf(p, 12, "%u", uint32(index / w));
+    *p++ = ')';
+    return size_t(p - str);
+}
+
+// Форматирование числа столбца в str: целые - без дробной части, остальные как %g (как cout), возвращает длину
+size_t formatValue(char* str, double value) {
+    if(value == floor(value) && fabs(value) < 1e15)
+        return size_t(snprintf(str, 32, "%.0f", value));
+    return size_t(snprintf(str, 32, "%g", value));
+}
+
+/* Приведение карт к одному представлению для обхода объединения (см. DefectMap::forEachUnion).
+ * Битовые карты нужны только если хотя бы одна карта уже стала битовой, иначе обход идёт слиянием массивов индексов.
+ * forEachUnion сам переводит карты во временные битовые копии, но вывод обходит объединение дважды,
+ * поэтому карты переводятся один раз на месте.
+ */
+void prepareUnion(DefectMap* const brokenPixels[numberOfMethods]) {
+    bool anyBitmap = false;
+    for(uint8 method = 0; method < numberOfMethods; method++) {
+        if(brokenPixels[method] != nullptr && brokenPixels[method]->representation() == DefectMap::Bitmap)
+            anyBitmap = true;
+    }
+    for(uint8 method = 0; anyBitmap && method < numberOfMethods; method++) {
+        if(brokenPixels[method] != nullptr)
+            brokenPixels[method]->toBitmap();
+    }
+}
+
+// Количество пикселей, отобранных хотя бы одним методом
+size_t unionCount(const DefectMap* const brokenPixels[numberOfMethods]) {
+    size_t count = 0;
+    DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&count](size_t, uint32) { count++; });
+    return count;
+}
+
+/*!
+ * \brief Таблица битых пикселей с отметками методов, обнаруживших каждый пиксель (или со значениями столбцов columns).
+ * Текст совпадает с прежним выводом через cout, но строки формируются в буфере.
+ */
+void writeTable(BufferedWriter& out, const DefectMap* const brokenPixels[numberOfMethods], uint32 w, const PixelColumns* columns) {
+    uint8 selectedMethods = 0;
+    for(uint8 method = 0; method < numberOfMethods; method++)
+        selectedMethods += brokenPixels[method] != nullptr;
+
+    out.put("Pixels total: ");
+    out.putNumber(unionCount(brokenPixels));
+    out.put('\n');
+    out.putRight("(w;h)", 11);
+    if(columns != nullptr) {
+        for(uint8 column = 0; column < columns->count; column++)
+            out.putRight(columns->titles[column], columns->widths[column]);
+        out.put('\n');
+        DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32) {
+            char text[32];
+            double values[maxPixelColumns];
+            out.putRight(text, formatPoint(text, el, w), 11);
+            columns->values(el, values);
+            for(uint8 column = 0; column < columns->count; column++)
+                out.putRight(text, formatValue(text, values[column]), columns->widths[column]);
+            out.put('\n');
+        });
+        return;
+    }
+    for(uint8 method = 0; method < numberOfMethods; method++) {
+        if(brokenPixels[method] != nullptr) {
+            char name[16];
+            snprintf(name, sizeof(name), "Method %u", unsigned(method));
+            out.putRight(name, 9);
+        }
+    }
+    out.put('\n');
+
+    // Доля методов принимает не больше numberOfMethods + 1 значений, поэтому её текст готовится заранее
+    char percents[numberOfMethods + 1][32];
+    for(uint8 k = 0; k <= selectedMethods; k++)
+        snprintf(percents[k], sizeof(percents[k]), "  %g%%\n", double(k) / max(selectedMethods, uint8(1)) * 100);
+    DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32 mask) {
+        char point[32];
+        out.putRight(point, formatPoint(point, el, w), 11);
+        for(uint8 method = 0; method < numberOfMethods; method++) {
+            if(brokenPixels[method] == nullptr)
+                continue;
+            out.putRight(mask & (1 << method) ? "True" : "False", 9);
+        }
+        out.put(percents[popcount64(mask)]);
+    });
+}
+
+// CSV: заголовок x,y,<методы> и строка на пиксель с 0/1 для каждого выбранного метода (или значениями столбцов columns)
+void writeCsv(BufferedWriter& out, const DefectMap* const brokenPixels[numberOfMethods], uint32 w, const PixelColumns* columns) {
+    out.put("x,y");
+    if(columns != nullptr) {
+        for(uint8 column = 0; column < columns->count; column++) {
+            out.put(',');
+            out.put(columns->names[column]);
+        }
+        out.put('\n');
+        DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32) {
+            char text[32];
+            double values[maxPixelColumns];
+            out.putNumber(el % w);
+            out.put(',');
+            out.putNumber(el / w);
+            columns->values(el, values);
+            for(uint8 column = 0; column < columns->count; column++) {
+                out.put(',');
+                out.put(text, formatValue(text, values[column]));
+            }
+            out.put('\n');
+        });
+        return;
+    }
+    for(uint8 method = 0; method < numberOfMethods; method++) {
+        if(brokenPixels[method] != nullptr) {
+            out.put(',');
+            out.put(methodNames[method]);
+        }
+    }
+    out.put('\n');
+    DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32 mask) {
+        out.putNumber(el % w);
+        out.put(',');
+        out.putNumber(el / w);
+        for(uint8 method = 0; method < numberOfMethods; method++) {
+            if(brokenPixels[method] == nullptr)
+                continue;
+            out.put(',');
+            out.put(char('0' + ((mask >> method) & 1)));
+        }
+        out.put('\n');
+    });
+}
+
+/* JSON: размеры, имена методов по номерам битов и пиксели массивами [x, y, маска методов].
+ * Со столбцами columns вместо имён методов пишутся имена столбцов, а пиксели - массивами [x, y, значения столбцов].
+ */
+void writeJson(BufferedWriter& out, const DefectMap* const brokenPixels[numberOfMethods], uint32 w, uint32 h, const PixelColumns* columns) {
+    out.put("{\"width\":");
+    out.putNumber(w);
+    out.put(",\"height\":");
+    out.putNumber(h);
+    out.put(columns != nullptr ? ",\"columns\":[" : ",\"methods\":[");
+    const uint8 names = columns != nullptr ? columns->count : numberOfMethods;
+    for(uint8 i = 0; i < names; i++) {
+        if(i > 0)
+            out.put(',');
+        out.put('"');
+        out.put(columns != nullptr ? columns->names[i] : methodNames[i]);
+        out.put('"');
+    }
+    out.put("],\"pixels\":[");
+    bool first = true;
+    DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32 mask) {
+        out.put(first ? "\n[" : ",\n[");
+        first = false;
+        out.putNumber(el % w);
+        out.put(',');
+        out.putNumber(el / w);
+        if(columns != nullptr) {
+            char text[32];
+            double values[maxPixelColumns];
+            columns->values(el, values);
+            for(uint8 column = 0; column < columns->count; column++) {
+                out.put(',');
+                out.put(text, formatValue(text, values[column]));
+            }
+        }
+        else {
+            out.put(',');
+            out.putNumber(mask);
+        }
+        out.put(']');
+    });
+    out.put("\n]}\n");
+}
+
+// Двоичный файл: заголовок DefectFileHeader и записи x, y, маска методов
+void writeBinary(BufferedWriter& out, const DefectMap* const brokenPixels[numberOfMethods], uint32 w, uint32 h) {
+    DefectFileHeader header = {};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.width = w;
+    header.height = h;
+    for(uint8 method = 0; method < numberOfMethods; method++)
+        header.methods |= brokenPixels[method] != nullptr ? 1u << method : 0u;
+    header.count = uint32(unionCount(brokenPixels));
+    out.putBytes(&header, sizeof(header));
+    DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32 mask) {
+        uint8 record[9];
+        const uint32 x = uint32(el % w), y = uint32(el / w);
+        memcpy(record, &x, 4);
+        memcpy(record + 4, &y, 4);
+        record[8] = uint8(mask);
+        out.putBytes(record, sizeof(record));
+    });
+}
+
+/*!
+ * \brief Карта пикселей, отобранных хотя бы одним методом, в компактном виде для повторного чтения (см. readDefectList):
+ * заголовок DefectMapFileHeader и отсортированные индексы или слова битовой карты - смотря по тому, что меньше.
+ */
+void writeMap(BufferedWriter& out, const DefectMap* const brokenPixels[numberOfMethods], uint32 w, uint32 h) {
+    DefectMap defects(size_t(w) * h);
+    for(uint8 method = 0; method < numberOfMethods; method++) {
+        if(brokenPixels[method] != nullptr)
+            defects.unite(*brokenPixels[method]);
+    }
+    // Объединение могло стать битовым, хотя индексов немного
+    if(defects.representation() == DefectMap::Bitmap && defects.count() * sizeof(uint32) < defects.words().size() * sizeof(uint64))
+        defects.toIndices();
+
+    DefectMapFileHeader header = {};
+    memcpy(header.magic, defectMapMagic, sizeof(defectMapMagic));
+    header.version = defectMapVersion;
+    header.width = w;
+    header.height = h;
+    header.representation = defects.representation();
+    if(defects.representation() == DefectMap::Indices) {
+        header.count = defects.indices().size();
+        out.putBytes(&header, sizeof(header));
+        out.putBytes(defects.indices().data(), defects.indices().size() * sizeof(uint32));
+    }
+    else {
+        header.count = defects.words().size();
+        out.putBytes(&header, sizeof(header));
+        out.putBytes(defects.words().data(), defects.words().size() * sizeof(uint64));
+    }
+}
+
+/*!
+ * \brief Запись TIFF-маски размером с изображение.
+ * Маска формируется полосами по 256 КБ и сжимается PackBits (маска почти целиком нулевая).
+ * \param path - путь к файлу
+ * \param bits - 8 (значение - маска методов) или 1 (пиксель отобран хотя бы одним методом)
+ * \return В случае успеха вернёт 0, иначе 8
+ */
+uint8 writeMask(const string& path, uint16 bits, const DefectMap* const brokenPixels[numberOfMethods], uint32 w, uint32 h) {
+    TIFF* tif = TIFFOpen(path.c_str(), "w");
+    if(!tif)
+        return 8;
+    const size_t rowBytes = bits == 8 ? w : (size_t(w) + 7) / 8;
+    const uint32 rowsPerStrip = uint32(clamp(size_t(256 * 1024) / max(rowBytes, size_t(1)), size_t(1), size_t(h)));
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, w);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, h);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, bits);
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_PACKBITS);
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, rowsPerStrip);
+
+    const uint32 strips = (h + rowsPerStrip - 1) / rowsPerStrip;
+    uint8* strip = new uint8[rowsPerStrip * rowBytes];
+    uint32 current = 0; // Номер заполняемой полосы
+    bool ok = true;
+    auto writeStrip = [&]() {
+        const size_t rows = min(rowsPerStrip, h - current * rowsPerStrip);
+        ok = ok && TIFFWriteEncodedStrip(tif, current, strip, tmsize_t(rows * rowBytes)) != -1;
+        fill(strip, strip + rowsPerStrip * rowBytes, uint8(0));
+        current++;
+    };
+    fill(strip, strip + rowsPerStrip * rowBytes, uint8(0));
+    DefectMap::forEachUnion(brokenPixels, numberOfMethods, [&](size_t el, uint32 mask) {
+        const uint32 x = uint32(el % w), y = uint32(el / w);
+        while(y >= (current + 1) * rowsPerStrip)
+            writeStrip();
+        uint8* row = strip + (y - current * rowsPerStrip) * rowBytes;
+        if(bits == 8)
+            row[x] = uint8(mask);
+        else
+            row[x / 8] |= uint8(0x80 >> (x % 8));
+    });
+    while(current < strips)
+        writeStrip();
+    delete[] strip;
+    TIFFClose(tif);
+    return ok ? 0 : 8;
+}
+
+} // namespace
+
+/*!
+ * \brief Разбор имени формата вывода
+ * \param name - table, csv, json, binary, mask8, mask1 или map
+ * \param format - формат
+ * \return В случае успеха вернёт true, иначе false
+ */
+bool parseOutputFormat(const string& name, OutputFormat& format) {
+    static const char* names[] = {"table", "csv", "json", "binary", "mask8", "mask1", "map"};
+    for(uint8 i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if(name == names[i]) {
+            format = OutputFormat(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * \brief Формат вывода по расширению файла: .csv, .json, .bin, .tif/.tiff (8-битная маска), .bpm (карта), иначе таблица
+ * \param path - путь к файлу
+ */
+OutputFormat outputFormatOf(const string& path) {
+    const size_t dot = path.rfind('.');
+    string ext = dot == string::npos ? string() : path.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return char(tolower(uint8(c))); });
+    if(ext == "csv")
+        return OUTPUT_CSV;
+    if(ext == "json")
+        return OUTPUT_JSON;
+    if(ext == "bin")
+        return OUTPUT_BINARY;
+    if(ext == "tif" || ext == "tiff")
+        return OUTPUT_MASK8;
+    if(ext == "bpm")
+        return OUTPUT_MAP;
+    return OUTPUT_TABLE;
+}
+
+// Расширение файла для формата (для вывода пакетной обработки в папку)
+const char* outputExtension(OutputFormat format) {
+    static const char* extensions[] = {".txt", ".csv", ".json", ".bin", ".tif", ".tif", ".bpm"};
+    return extensions[format];
+}
+
+/*!
+ * \brief Запись найденных пикселей в выбранном формате.
+ * Пиксели обходятся один раз объединением карт методов, текст и записи накапливаются в буфере
+ * и пишутся в файл блоками по 1 МБ.
+ * \param path - путь к файлу; "-" - стандартный вывод (только для текстовых и двоичных форматов)
+ * \param format - формат
+ * \param brokenPixels - результаты методов (nullptr для невыбранных); карты могут быть переведены в битовое представление
+ * \param w - ширина изображения
+ * \param h - высота изображения
+ * \param columns - числовые столбцы пикселя для текстовых форматов вместо отметок методов (nullptr - без них)
+ * \return В случае успеха вернёт 0, иначе 8 (не удалось записать файл)
+ */
+uint8 writeDefects(const string& path, OutputFormat format, DefectMap* const brokenPixels[numberOfMethods], uint32 w, uint32 h,
+                   const PixelColumns* columns) {
+    prepareUnion(brokenPixels);
+    if(format == OUTPUT_MASK8 || format == OUTPUT_MASK1) {
+        if(path == "-")
+            return 8;
+        return writeMask(path, format == OUTPUT_MASK8 ? 8 : 1, brokenPixels, w, h);
+    }
+
+    const bool toStdout = path == "-";
+    FILE* file = toStdout ? stdout : fopen(path.c_str(), format == OUTPUT_BINARY || format == OUTPUT_MAP ? "wb" : "w");
+    if(!file)
+        return 8;
+    bool ok;
+    {
+        BufferedWriter out(file);
+        switch(format) {
+        case OUTPUT_CSV:
+            writeCsv(out, brokenPixels, w, columns);
+            break;
+        case OUTPUT_JSON:
+            writeJson(out, brokenPixels, w, h, columns);
+            break;
+        case OUTPUT_BINARY:
+            writeBinary(out, brokenPixels, w, h);
+            break;
+        case OUTPUT_MAP:
+            writeMap(out, brokenPixels, w, h);
+            break;
+        default:
+            writeTable(out, brokenPixels, w, columns);
+            break;
+        }
+        ok = out.flush();
+    }
+    if(toStdout)
+        ok = fflush(stdout) == 0 && ok;
+    else
+        ok = fclose(file) == 0 && ok;
+    return ok ? 0 : 8;
+}
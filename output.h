@@ -0,0 +1,58 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <functional>
+#include <string>
+#include "defectmap.h"
+#include "detectors.h"
+
+/*!
+ * \brief Форматы вывода найденных битых пикселей
+ */
+enum OutputFormat : uint8 {
+    OUTPUT_TABLE = 0,  // Таблица для чтения человеком (как раньше выводилась в консоль)
+    OUTPUT_CSV = 1,    // x,y и столбец 0/1 для каждого выбранного метода
+    OUTPUT_JSON = 2,   // {"width", "height", "methods", "pixels": [[x, y, маска методов], ...]}
+    OUTPUT_BINARY = 3, // Заголовок DefectFileHeader и записи по 9 байт: x (uint32), y (uint32), маска методов (uint8)
+    OUTPUT_MASK8 = 4,  // 8-битная TIFF-маска размером с изображение, значение пикселя - маска методов
+    OUTPUT_MASK1 = 5,  // 1-битная TIFF-маска размером с изображение, 1 - пиксель отобран хотя бы одним методом
+    OUTPUT_MAP = 6     // Карта пикселей, отобранных хотя бы одним методом: DefectMapFileHeader и представление DefectMap
+};
+
+/*!
+ * \brief Заголовок двоичного файла найденных пикселей (OUTPUT_BINARY).
+ * За ним следуют count записей без выравнивания; числа - в порядке байтов процессора.
+ * Бит i маски методов соответствует методу methodNames[i].
+ */
+struct DefectFileHeader {
+    char magic[4]; // "BPDL"
+    uint32 version;
+    uint32 width;
+    uint32 height;
+    uint32 methods; // Набор флагов выбранных методов
+    uint32 count;   // Количество записей
+    uint32 reserved[2];
+};
+
+/*!
+ * \brief Числовые столбцы пикселя для текстовых форматов (статистика кадров при --classify).
+ * Выводятся вместо отметок методов: в таблице и CSV - вместо столбцов методов, в JSON - вместо маски.
+ * Двоичные форматы и маски пишутся как обычно, по картам brokenPixels.
+ */
+struct PixelColumns {
+    uint8 count;                // Количество столбцов, не больше maxPixelColumns
+    const char* const* names;   // Имена столбцов в CSV и JSON
+    const char* const* titles;  // Заголовки столбцов таблицы
+    const uint8* widths;        // Ширина столбцов таблицы
+    std::function<void(size_t index, double* values)> values; // Значения столбцов пикселя index
+};
+
+const uint8 maxPixelColumns = 8;
+
+bool parseOutputFormat(const std::string& name, OutputFormat& format);
+OutputFormat outputFormatOf(const std::string& path);
+const char* outputExtension(OutputFormat format);
+uint8 writeDefects(const std::string& path, OutputFormat format, DefectMap* const brokenPixels[numberOfMethods], uint32 w, uint32 h,
+                   const PixelColumns* columns = nullptr);
+
+#endif // OUTPUT_H
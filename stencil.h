@@ -0,0 +1,253 @@
+#ifndef STENCIL_H
+#define STENCIL_H
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include "tiffio.h"
+
+/*!
+ * \brief Свойства типа пикселя для шаблонных детекторов.
+ * Sum - тип сумм окрестности, Value - тип разностей и средних, Threshold - тип порога,
+ * maxValue - максимальное значение цвета (мзц).
+ * Порог задаётся в единицах 16-битного изображения и переводится в диапазон типа функцией threshold,
+ * поэтому один и тот же процент от мзц отбирает одинаковые пиксели независимо от разрядности.
+ */
+template<typename Pixel> struct PixelTraits;
+
+template<> struct PixelTraits<uint8> {
+    typedef uint32 Sum;
+    typedef int32 Value;
+    typedef uint8 Threshold;
+    static constexpr uint32 maxValue = 0xff;
+    static constexpr Threshold threshold(uint16 t) { return Threshold(t / 257); }
+};
+
+template<> struct PixelTraits<uint16> {
+    typedef uint32 Sum;
+    typedef int32 Value;
+    typedef uint16 Threshold;
+    static constexpr uint32 maxValue = 0xffff;
+    static constexpr Threshold threshold(uint16 t) { return t; }
+};
+
+// Вещественные кадры считаются нормированными на [0, 1]. Суммы считаются в double,
+// чтобы скользящие суммы среднего k*k не накапливали ошибку округления
+template<> struct PixelTraits<float> {
+    typedef double Sum;
+    typedef double Value;
+    typedef double Threshold;
+    static constexpr double maxValue = 1.0;
+    static constexpr Threshold threshold(uint16 t) { return t / 65535.0; }
+};
+
+/*!
+ * \brief Построчные ядра детекторов, специализируемые при компиляции под тип пикселя и размер окна.
+ * Смещения окрестности заданы constexpr-таблицами и разворачиваются свёрткой по индексам,
+ * поэтому каждое сочетание типа и окна компилируется в ядро без циклов по окрестности.
+ * Ядра обрабатывают столбцы [x0, x1) так же, как RowKernels (см. kernels.h).
+ * Столбцы обрабатываются блоками постоянной длины: цикл с известным числом итераций, пишущий только
+ * в локальный массив, компилятор векторизует и при -O2. Результаты блока затем переносятся в выходной массив.
+ */
+namespace stencil {
+
+/* Соседние пиксели в окне 3*3 (строка и смещение по столбцу относительно проверяемого)
+ * p - проверяемый пиксель
+ * 5 6 7
+ * 3 p 4
+ * 0 1 2
+ */
+constexpr uint8 adjacentRows[8] = {0, 0, 0, 1, 1, 2, 2, 2};
+constexpr int32 adjacentCols[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+
+typedef std::make_integer_sequence<uint8, 8> Neighbors;
+
+// Значения 8 соседей пикселя x: rows - строки y-1..y+1 растра или массива значений для пикселей
+template<typename T, uint8... dir>
+inline void loadNeighbors(const T* const rows[3], size_t x, T* out, std::integer_sequence<uint8, dir...>) {
+    ((out[dir] = rows[adjacentRows[dir]][x + adjacentCols[dir]]), ...);
+}
+
+template<typename Sum, typename Pixel, uint8... dir>
+inline Sum neighborSum(const Pixel* const rows[3], size_t x, std::integer_sequence<uint8, dir...>) {
+    return (Sum(rows[adjacentRows[dir]][x + adjacentCols[dir]]) + ...);
+}
+
+template<typename Pixel, uint8... dir>
+inline uint8 sameCount(const Pixel* const rows[3], size_t x, std::integer_sequence<uint8, dir...>) {
+    const Pixel c = rows[1][x];
+    return uint8((uint8(rows[adjacentRows[dir]][x + adjacentCols[dir]] == c) + ...));
+}
+
+const uint32 chunk = 64; // Столбцов в блоке
+
+// Перенос номеров отмеченных столбцов блока (flags - 0 или 1) в hits, пустые восьмёрки пропускаются целиком
+inline uint32 appendFlags(const uint8* flags, uint32 x, uint32* hits) {
+    uint32 n = 0;
+    for(uint32 i = 0; i < chunk; i += 8) {
+        uint64 word;
+        memcpy(&word, flags + i, sizeof(word));
+        if(word == 0)
+            continue;
+        for(uint32 j = i; j < i + 8; j++) {
+            hits[n] = x + j;
+            n += flags[j];
+        }
+    }
+    return n;
+}
+
+// Проверка столбцов [x0, x1) блоками: check(x) возвращает true для отобранных столбцов
+template<typename Check>
+inline uint32 checkColumns(uint32 x0, uint32 x1, uint32* hits, Check check) {
+    uint32 n = 0;
+    uint32 x = x0;
+    for(; x + chunk <= x1; x += chunk) {
+        uint8 flags[chunk];
+        const size_t base = x; // 64-битный индекс не переполняется, поэтому доступ к памяти непрерывный
+        for(size_t i = 0; i < chunk; i++)
+            flags[i] = check(base + i);
+        n += appendFlags(flags, x, hits + n);
+    }
+    for(; x < x1; x++) {
+        hits[n] = x;
+        n += check(x);
+    }
+    return n;
+}
+
+// Превышает ли модуль разницы порог (без ветвлений; для целых - одним беззнаковым сравнением)
+template<typename Value, typename Threshold>
+inline bool exceeds(Value delta, Threshold threshold) {
+    if constexpr(std::is_integral<Value>::value)
+        return uint32(delta + Value(threshold)) > 2u * threshold;
+    else
+        return (delta > Value(threshold)) | (delta < -Value(threshold));
+}
+
+// Превышает ли модуль разницы пикселей порог. Для целых пикселей разница считается в типе пикселя
+// (без расширения, поэтому в векторный регистр помещается больше пикселей)
+template<typename Pixel, typename Threshold>
+inline bool differs(Pixel a, Pixel b, Threshold threshold) {
+    typedef typename PixelTraits<Pixel>::Value Value;
+    if constexpr(std::is_integral<Pixel>::value)
+        return Pixel(a > b ? a - b : b - a) > threshold;
+    else
+        return exceeds(Value(a) - Value(b), threshold);
+}
+
+// Превышает ли порог отличие пикселя x от хотя бы одного из 8 соседей
+template<typename Pixel, typename Threshold, uint8... dir>
+inline bool anyNeighborExceeds(const Pixel* const rows[3], size_t x, Threshold threshold, std::integer_sequence<uint8, dir...>) {
+    const Pixel c = rows[1][x];
+    return (differs(c, rows[adjacentRows[dir]][x + adjacentCols[dir]], threshold) | ...);
+}
+
+// Медиана трёх значений (без ветвлений, зависящих от данных)
+template<typename T>
+inline T median(T f, T s, T t) {
+    return std::max(std::min(f, s), std::min(std::max(f, s), t));
+}
+
+// Суммы 8 соседей и количество соседей того же цвета для пикселей строки r1 (same может быть nullptr)
+template<typename Pixel>
+void neighborSums(const Pixel* r0, const Pixel* r1, const Pixel* r2, uint32 x0, uint32 x1,
+                  typename PixelTraits<Pixel>::Sum* sums, uint8* same) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    const Pixel* const rows[3] = {r0, r1, r2};
+    uint32 x = x0;
+    for(; x + chunk <= x1; x += chunk) {
+        Sum blockSums[chunk];
+        const size_t base = x;
+        for(size_t i = 0; i < chunk; i++)
+            blockSums[i] = neighborSum<Sum>(rows, base + i, Neighbors());
+        memcpy(sums + x, blockSums, sizeof(blockSums));
+        if(same) {
+            uint8 blockSame[chunk];
+            for(size_t i = 0; i < chunk; i++)
+                blockSame[i] = sameCount(rows, base + i, Neighbors());
+            memcpy(same + x, blockSame, sizeof(blockSame));
+        }
+    }
+    for(; x < x1; x++) {
+        sums[x] = neighborSum<Sum>(rows, x, Neighbors());
+        if(same)
+            same[x] = sameCount(rows, x, Neighbors());
+    }
+}
+
+// Проверка строки методом среднего 3*3 по суммам 8 соседей
+template<typename Pixel>
+uint32 avg3Row(const Pixel* row, const typename PixelTraits<Pixel>::Sum* sums, uint32 x0, uint32 x1,
+               const typename PixelTraits<Pixel>::Threshold threshold, uint32* hits) {
+    typedef typename PixelTraits<Pixel>::Value Value;
+    return checkColumns(x0, x1, hits, [=](size_t x) {
+        return exceeds(Value(sums[x] / 8) - Value(row[x]), threshold);
+    });
+}
+
+// Сдвиг столбцовых сумм на строку: добавление строки added и вычитание строки removed
+template<typename Pixel>
+void shiftColumnSums(typename PixelTraits<Pixel>::Sum* colSums, const Pixel* added, const Pixel* removed, uint32 x0, uint32 x1) {
+    typedef typename PixelTraits<Pixel>::Sum Sum;
+    for(uint32 x = x0; x < x1; x++)
+        colSums[x] += Sum(added[x]) - Sum(removed[x]);
+}
+
+/* Проверка строки методом среднего k*k по суммам квадратов boxSums (с центральным пикселем).
+ * K - размер квадрата, известный при компиляции (деление на K*K-1 заменяется умножением),
+ * или 0, если размер задаётся во время работы через adjSize = k*k-1.
+ */
+template<uint32 K, typename Pixel>
+uint32 avgBoxRow(const Pixel* row, const typename PixelTraits<Pixel>::Sum* boxSums, uint32 x0, uint32 x1, uint32 adjSize,
+                 const typename PixelTraits<Pixel>::Threshold threshold, uint32* hits) {
+    typedef typename PixelTraits<Pixel>::Value Value;
+    const uint32 n8 = K ? K * K - 1 : adjSize;
+    return checkColumns(x0, x1, hits, [=](size_t x) {
+        return exceeds(Value((boxSums[x] - row[x]) / n8) - Value(row[x]), threshold);
+    });
+}
+
+// Медиана окрестности 3*3 пикселя x строки r1
+template<typename Pixel>
+inline Pixel median3(const Pixel* r0, const Pixel* r1, const Pixel* r2, size_t x) {
+    const Pixel cPixel = r1[x];
+    /* Поиск медианы пикселей происходит в порядке:
+     * 1. Для каждой пары вместе с центральным пикселем
+     * 2. Для медиан пар 0 1 и центрального пикселя и медиан пар 2 3 и центрального пикселя
+     * 3. Для медиан из пункта 2 и центрального пикселя
+     */
+    return median(
+        cPixel,
+        median(cPixel, median(cPixel, r1[x-1], r1[x+1]), median(cPixel, r0[x], r2[x])),
+        median(cPixel, median(cPixel, r0[x-1], r2[x+1]), median(cPixel, r2[x-1], r0[x+1]))
+    );
+}
+
+// Проверка строки r1 методом медианы 3*3
+template<typename Pixel>
+uint32 median3Row(const Pixel* r0, const Pixel* r1, const Pixel* r2, uint32 x0, uint32 x1,
+                  const typename PixelTraits<Pixel>::Threshold threshold, uint32* hits) {
+    typedef typename PixelTraits<Pixel>::Value Value;
+    return checkColumns(x0, x1, hits, [=](size_t x) {
+        return exceeds(Value(median3(r0, r1, r2, x)) - Value(r1[x]), threshold);
+    });
+}
+
+/* Отбор кандидатов строки r1: пиксели, отличие которых хотя бы от одного соседа 3*3 превышает порог.
+ * Ни один метод 3*3 не отберёт пиксель, не прошедший эту проверку: и среднее, и медиана, и выбранный
+ * методом иерархий сосед не могут отличаться от пикселя сильнее, чем самый далёкий сосед.
+ */
+template<typename Pixel>
+uint32 deviationRow(const Pixel* r0, const Pixel* r1, const Pixel* r2, uint32 x0, uint32 x1,
+                    const typename PixelTraits<Pixel>::Threshold threshold, uint32* hits) {
+    return checkColumns(x0, x1, hits, [=](size_t x) {
+        const Pixel* const rows[3] = {r0, r1, r2};
+        return anyNeighborExceeds(rows, x, threshold, Neighbors());
+    });
+}
+
+} // namespace stencil
+
+#endif // STENCIL_H
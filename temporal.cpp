@@ -0,0 +1,194 @@
+#include "temporal.h"
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include "metrics.h"
+
+using namespace std;
+
+namespace {
+
+const char magic[4] = {'B', 'P', 'T', 'M'};
+const uint32 version = 1;
+
+// Размер файла статистики для npixels пикселей
+size_t mapSize(size_t npixels) {
+    return sizeof(TemporalMap::Header) + npixels * (sizeof(uint32) + 2 * sizeof(double));
+}
+
+} // namespace
+
+/*!
+ * \brief Открытие файла статистики для накопления. Если файла нет, он будет создан при первом кадре
+ * \param path - Путь до файла
+ * \return В случае успеха вернёт 0, иначе 6 (файл повреждён или имеет другой формат)
+ */
+uint8 TemporalMap::open(const char* path) {
+    this->path = path;
+    header = nullptr;
+    if(!file.open(path, true))
+        return 0;
+    return attach() ? 0 : 6;
+}
+
+/*!
+ * \brief Открытие существующего файла статистики только для чтения
+ * \param path - Путь до файла
+ * \return В случае успеха вернёт 0, иначе код ошибки (1 - файл не открылся, 6 - файл повреждён)
+ */
+uint8 TemporalMap::load(const char* path) {
+    this->path = path;
+    header = nullptr;
+    if(!file.open(path))
+        return 1;
+    return attach() ? 0 : 6;
+}
+
+// Проверка заголовка и получение массивов из отображённого файла
+bool TemporalMap::attach() {
+    if(file.size() < sizeof(Header))
+        return false;
+    Header* h = static_cast<Header*>(file.data());
+    const size_t npixels = size_t(h->width) * h->height;
+    if(memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != version || file.size() < mapSize(npixels))
+        return false;
+    header = h;
+    // Массивы double идут первыми, сразу за заголовком в 32 байта, чтобы быть выровненными при любом числе пикселей
+    mean = reinterpret_cast<double*>(header + 1);
+    m2 = mean + npixels;
+    hits = reinterpret_cast<uint32*>(m2 + npixels);
+    return true;
+}
+
+/*!
+ * \brief Начало добавления кадра: создание файла при первом кадре или проверка размера кадра.
+ * После успешного begin() остатки строк кадра добавляются через addResiduals(), а кадр завершается commit().
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \return В случае успеха вернёт 0, иначе код ошибки:
+ * 1 - не удалось создать файл
+ * 6 - размер кадра не совпадает с размером в файле
+ */
+uint8 TemporalMap::begin(uint32 w, uint32 h) {
+    if(!header) {
+        if(!file.create(path.c_str(), mapSize(size_t(w) * h)))
+            return 1;
+        Header* created = static_cast<Header*>(file.data());
+        memcpy(created->magic, magic, sizeof(magic));
+        created->version = version;
+        created->width = w;
+        created->height = h;
+        if(!attach())
+            return 1;
+    }
+    if(header->width != w || header->height != h)
+        return 6;
+    return 0;
+}
+
+/*!
+ * \brief Добавление остатков строки кадра по суммам 8 соседей, посчитанным детекторами.
+ * Для крайних столбцов статистика остатка не накапливается. Строки можно добавлять из разных потоков,
+ * каждую строку - один раз за кадр.
+ * \param y - номер строки
+ * \param row - строка кадра
+ * \param sums - суммы 8 соседей пикселей строки
+ */
+void TemporalMap::addResiduals(size_t y, const uint16* row, const uint32* sums) {
+    const uint32 w = header->width;
+    const double n = header->frames + 1.0;
+    double* mu = mean + y * w;
+    double* q = m2 + y * w;
+    for(uint32 x = 1; x < w - 1; x++) {
+        const double residual = double(row[x]) - sums[x] / 8.0;
+        const double delta = residual - mu[x];
+        mu[x] += delta / n;
+        q[x] += delta * (residual - mu[x]);
+    }
+}
+
+/*!
+ * \brief Завершение добавления кадра: учёт пикселей, отобранных методами, и увеличение числа кадров
+ * \param brokenPixels - результаты методов для кадра (nullptr для невыбранных)
+ */
+void TemporalMap::commit(DefectMap* const brokenPixels[numberOfMethods]) {
+    DefectMap hitPixels(size_t(header->width) * header->height);
+    for(uint8 m = 0; m < numberOfMethods; m++) {
+        if(brokenPixels[m])
+            hitPixels.unite(*brokenPixels[m]);
+    }
+    hitPixels.forEach([this](size_t index) { hits[index]++; });
+    header->frames++;
+}
+
+// Выборочная дисперсия остатка пикселя
+double TemporalMap::variance(size_t index) const {
+    return header->frames > 1 ? m2[index] / double(header->frames - 1) : 0.0;
+}
+
+/*!
+ * \brief Классификация пикселей по накопленной статистике за один проход.
+ * Пиксель считается битым, если его отбирали в доле кадров не меньше minHitRate
+ * или средний остаток по всем кадрам по модулю превышает порог.
+ * \param threshold - порог среднего остатка
+ * \param minHitRate - минимальная доля кадров с попаданием (0; 1]
+ * \return Набор индексов битых пикселей
+ */
+DefectMap* TemporalMap::classify(const uint16 threshold, double minHitRate) const {
+    const size_t npixels = size_t(width()) * height();
+    DefectMap* defects = new DefectMap(npixels);
+    if(frames() == 0)
+        return defects;
+    const double minHits = minHitRate * frames();
+    for(size_t i = 0; i < npixels; i++) {
+        if(hits[i] >= minHits || fabs(mean[i]) > threshold)
+            defects->insert(i);
+    }
+    return defects;
+}
+
+/*!
+ * \brief Совмещённый поиск битых пикселей с добавлением кадра в статистику.
+ * Остатки кадра считаются по суммам соседей, которые детекторы посчитали для метода среднего 3*3,
+ * так что изображение проходится один раз.
+ * \param rows - строки кадра
+ * \param w - Ширина изображения
+ * \param h - Высота изображения
+ * \param threshold - порог по которому будут отбираться искомые пиксели
+ * \param methods - набор флагов DetectionMethod выбранных методов
+ * \param brokenPixels - массив результатов (см. fusedBrokenPixelSearch)
+ * \param temporal - статистика, в которую добавляется кадр
+ * \param pool - пул потоков (nullptr - последовательная обработка)
+ * \param metrics - показатели кадра (nullptr - без замеров)
+ * \return В случае успеха вернёт 0, иначе код ошибки TemporalMap::begin
+ * или 2, если кадр не 16-битный (статистика хранится в единицах 16-битного изображения)
+ */
+template<typename Pixel>
+uint8 accumulatingSearch(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                         DefectMap* brokenPixels[numberOfMethods], TemporalMap& temporal, ThreadPool* pool, FrameMetrics* metrics) {
+    // При ошибке результатов методов нет
+    for(uint8 m = 0; m < numberOfMethods; m++)
+        brokenPixels[m] = nullptr;
+    if constexpr(is_same<Pixel, uint16>::value) {
+        const uint8 errCode = temporal.begin(w, h);
+        if(errCode != 0)
+            return errCode;
+        fusedBrokenPixelSearch(rows, w, h, threshold, methods, brokenPixels, [&temporal](size_t y, const uint16* row, const uint32* sums) {
+            temporal.addResiduals(y, row, sums);
+        }, pool, metrics);
+        StageTimer timer(metrics, STAGE_ACCUMULATE);
+        temporal.commit(brokenPixels);
+        return 0;
+    }
+    else {
+        (void)rows, (void)w, (void)h, (void)threshold, (void)methods, (void)temporal, (void)pool, (void)metrics;
+        return 2;
+    }
+}
+
+template uint8 accumulatingSearch(const BasicRasterRows<uint8>&, uint32, uint32, const uint16, uint8, DefectMap*[], TemporalMap&,
+                                  ThreadPool*, FrameMetrics*);
+template uint8 accumulatingSearch(const BasicRasterRows<uint16>&, uint32, uint32, const uint16, uint8, DefectMap*[], TemporalMap&,
+                                  ThreadPool*, FrameMetrics*);
+template uint8 accumulatingSearch(const BasicRasterRows<float>&, uint32, uint32, const uint16, uint8, DefectMap*[], TemporalMap&,
+                                  ThreadPool*, FrameMetrics*);
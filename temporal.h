@@ -0,0 +1,66 @@
+#ifndef TEMPORAL_H
+#define TEMPORAL_H
+
+#include <string>
+#include "defectmap.h"
+#include "detectors.h"
+#include "mappedfile.h"
+
+class ThreadPool;
+
+/*!
+ * \brief Накопление попиксельной статистики по последовательности кадров в файле, отображённом в память.
+ * Для каждого пикселя хранится количество кадров, в которых его отобрал хотя бы один метод,
+ * и среднее с суммой квадратов отклонений (по Уэлфорду) остатка c - (сумма 8 соседей)/8.
+ * Битый пиксель проявляется в каждом кадре, шум и края сцены - нет, поэтому классификация
+ * по накопленной статистике - один проход по файлу без повторного анализа кадров.
+ * Остатки считаются по суммам соседей, которые детекторы уже посчитали для метода среднего 3*3,
+ * поэтому кадр добавляется в три шага: begin() перед поиском, addResiduals() для каждой строки
+ * во время поиска (см. fusedBrokenPixelSearch с NeighborRowVisitor), commit() с результатами методов.
+ * Формат файла: заголовок Header, затем массивы mean (double), m2 (double), hits (uint32) по пикселю на элемент.
+ * Среднее и сумма квадратов хранятся в double: во float сумма квадратов теряет точность уже на сотнях кадров.
+ */
+class TemporalMap {
+public:
+    struct Header {
+        char magic[4]; // "BPTM"
+        uint32 version;
+        uint32 width;
+        uint32 height;
+        uint32 frames;
+        uint32 reserved[3];
+    };
+
+    TemporalMap() = default;
+
+    uint8 open(const char* path);
+    uint8 load(const char* path);
+    uint8 begin(uint32 w, uint32 h);
+    void addResiduals(size_t y, const uint16* row, const uint32* sums);
+    void commit(DefectMap* const brokenPixels[numberOfMethods]);
+    DefectMap* classify(const uint16 threshold, double minHitRate) const;
+
+    uint32 width() const { return header ? header->width : 0; }
+    uint32 height() const { return header ? header->height : 0; }
+    uint32 frames() const { return header ? header->frames : 0; }
+    uint32 hitCount(size_t index) const { return hits[index]; }
+    double meanResidual(size_t index) const { return mean[index]; }
+    double variance(size_t index) const;
+
+private:
+    bool attach();
+
+    std::string path;
+    MappedFile file;
+    Header* header = nullptr;
+    uint32* hits = nullptr;
+    double* mean = nullptr;
+    double* m2 = nullptr;
+};
+
+template<typename Pixel>
+uint8 accumulatingSearch(const BasicRasterRows<Pixel>& rows, uint32 w, uint32 h, const uint16 threshold, uint8 methods,
+                         DefectMap* brokenPixels[numberOfMethods], TemporalMap& temporal, ThreadPool* pool = nullptr,
+                         FrameMetrics* metrics = nullptr);
+
+#endif // TEMPORAL_H
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "kernels.h"
+
+using namespace std;
+
+namespace {
+
+const uint32 padding = 64; // Запас за концом строки: векторные ядра не должны читать и писать за x1
+
+mt19937 rng(20240521);
+uint32 failures = 0;
+
+// Строка со случайными значениями. При narrow значения берутся из малого набора, чтобы часто встречались равные соседи.
+vector<uint16> randomRow(uint32 w, bool narrow) {
+    vector<uint16> row(w + padding);
+    uniform_int_distribution<uint32> wide(0, 65535);
+    uniform_int_distribution<uint32> small(0, 3);
+    for(uint16& value : row)
+        value = uint16(narrow ? 1000 * small(rng) : wide(rng));
+    return row;
+}
+
+void fail(const string& what, const char* level, uint32 w, uint32 x0, uint32 x1) {
+    if(failures++ < 20)
+        cerr << level << ": " << what << " differs (w = " << w << ", x0 = " << x0 << ", x1 = " << x1 << ")" << endl;
+}
+
+// Сравнение количества и номеров отобранных столбцов
+void compareHits(const string& what, const char* level, uint32 w, uint32 x0, uint32 x1,
+                 uint32 expectedCount, const vector<uint32>& expected, uint32 count, const vector<uint32>& hits) {
+    if(count != expectedCount || !equal(expected.begin(), expected.begin() + count, hits.begin()))
+        fail(what, level, w, x0, x1);
+}
+
+// Проверка всех ядер набора kernels на одной тройке строк и одном диапазоне столбцов
+void checkRange(const RowKernels& kernels, const char* level, const vector<uint16> rows[3], uint32 w, uint32 x0, uint32 x1) {
+    uniform_int_distribution<uint32> anyThreshold(0, 65535);
+    const uint16 thresholds[] = {0, 1, 300, 2000, uint16(anyThreshold(rng)), 65535};
+
+    vector<uint32> expectedSums(w + padding, 0), sums(w + padding, 0);
+    vector<uint8> expectedSame(w + padding, 0), same(w + padding, 0);
+    scalarKernels.neighborSums(rows[0].data(), rows[1].data(), rows[2].data(), x0, x1, expectedSums.data(), expectedSame.data());
+    kernels.neighborSums(rows[0].data(), rows[1].data(), rows[2].data(), x0, x1, sums.data(), same.data());
+    if(sums != expectedSums || same != expectedSame)
+        fail("neighborSums", level, w, x0, x1);
+    vector<uint32> sumsOnly(w + padding, 0);
+    kernels.neighborSums(rows[0].data(), rows[1].data(), rows[2].data(), x0, x1, sumsOnly.data(), nullptr);
+    if(sumsOnly != expectedSums)
+        fail("neighborSums without same", level, w, x0, x1);
+
+    vector<uint32> colSums(w + padding), expectedColSums;
+    uniform_int_distribution<uint32> colSum(65535, 100 * 65535);
+    for(uint32& sum : colSums)
+        sum = colSum(rng);
+    expectedColSums = colSums;
+    scalarKernels.shiftColumnSums(expectedColSums.data(), rows[2].data(), rows[0].data(), x0, x1);
+    kernels.shiftColumnSums(colSums.data(), rows[2].data(), rows[0].data(), x0, x1);
+    if(colSums != expectedColSums)
+        fail("shiftColumnSums", level, w, x0, x1);
+
+    // Размеры окна 3, 5 и 7, а также размеры около границы 16384, за которой векторные ядра переходят на скалярное
+    const uint32 adjSizes[] = {8, 24, 48, 16382, 16383, 16384, 16385};
+    const uint16* row = rows[1].data();
+    vector<uint32> expected(w + padding), hits(w + padding);
+    for(const uint16 threshold : thresholds) {
+        uint32 n = scalarKernels.avg3Row(row, expectedSums.data(), x0, x1, threshold, expected.data());
+        compareHits("avg3Row", level, w, x0, x1, n, expected, kernels.avg3Row(row, expectedSums.data(), x0, x1, threshold, hits.data()), hits);
+
+        for(const uint32 adjSize : adjSizes) {
+            // Сумма квадрата: центральный пиксель и adjSize соседей, не больше adjSize*65535 без центра
+            vector<uint32> boxSums(w + padding);
+            uniform_int_distribution<uint64> neighbors(0, uint64(adjSize) * 65535);
+            for(uint32 x = 0; x < w + padding; x++)
+                boxSums[x] = uint32(row[x] + neighbors(rng));
+            // Часть пикселей - с суммой ровно у порога, где сказывается округление деления
+            for(uint32 x = 0; x < w; x += 3)
+                boxSums[x] = row[x] + uint32(min<uint64>(uint64(adjSize) * 65535, uint64(adjSize) * (row[x] + threshold + x % 2)));
+            n = scalarKernels.avgBoxRow(row, boxSums.data(), x0, x1, adjSize, threshold, expected.data());
+            compareHits("avgBoxRow (adjSize = " + to_string(adjSize) + ")", level, w, x0, x1, n, expected,
+                        kernels.avgBoxRow(row, boxSums.data(), x0, x1, adjSize, threshold, hits.data()), hits);
+        }
+
+        n = scalarKernels.median3Row(rows[0].data(), row, rows[2].data(), x0, x1, threshold, expected.data());
+        compareHits("median3Row", level, w, x0, x1, n, expected,
+                    kernels.median3Row(rows[0].data(), row, rows[2].data(), x0, x1, threshold, hits.data()), hits);
+
+        n = scalarKernels.deviationRow(rows[0].data(), row, rows[2].data(), x0, x1, threshold, expected.data());
+        compareHits("deviationRow", level, w, x0, x1, n, expected,
+                    kernels.deviationRow(rows[0].data(), row, rows[2].data(), x0, x1, threshold, hits.data()), hits);
+    }
+}
+
+// Проверка набора ядер на строках разной ширины: полные строки без краёв и случайные поддиапазоны
+void checkKernels(const RowKernels& kernels, const char* level) {
+    const uint32 widths[] = {3, 4, 5, 7, 8, 9, 15, 16, 17, 18, 31, 33, 34, 63, 65, 127, 257, 1001, 4099};
+    for(const uint32 w : widths) {
+        for(int narrow = 0; narrow < 2; narrow++) {
+            const vector<uint16> rows[3] = {randomRow(w, narrow), randomRow(w, narrow), randomRow(w, narrow)};
+            checkRange(kernels, level, rows, w, 1, w - 1);
+            uniform_int_distribution<uint32> column(1, w - 1);
+            for(int i = 0; i < 4; i++) {
+                uint32 x0 = column(rng), x1 = column(rng);
+                if(x0 > x1)
+                    swap(x0, x1);
+                checkRange(kernels, level, rows, w, x0, x1);
+            }
+        }
+    }
+}
+
+} // namespace
+
+/*!
+ * \brief Сравнение векторных построчных ядер со скалярными: количество и номера отобранных столбцов,
+ * суммы соседей и столбцовые суммы должны совпадать точно. Наборы, которые процессор не поддерживает, пропускаются.
+ * \return 0, если все ядра совпали, иначе 1
+ */
+int main() {
+    const SimdLevel level = detectSimdLevel();
+    uint32 checked = 0;
+#ifdef KERNELS_X86
+    if(level >= SIMD_SSE41) {
+        checkKernels(sse41Kernels, "sse41");
+        checked++;
+    }
+    if(level >= SIMD_AVX2) {
+        checkKernels(avx2Kernels, "avx2");
+        checked++;
+    }
+#endif
+    // Скалярные ядра сравниваются сами с собой, чтобы проверить и тест на платформах без векторных наборов
+    checkKernels(scalarKernels, "scalar");
+    cout << "Instruction sets checked against scalar kernels: " << checked << ", failures: " << failures << endl;
+    return failures == 0 ? 0 : 1;
+}
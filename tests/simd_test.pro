@@ -0,0 +1,28 @@
+QT -= gui
+
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+TARGET = simd_test
+INCLUDEPATH += ..
+
+SOURCES += \
+        ../kernels.cpp \
+        ../kernels_avx2.cpp \
+        ../kernels_sse41.cpp \
+        simd_test.cpp
+
+HEADERS += \
+        ../kernels.h \
+        ../stencil.h
+
+#libtif
+include(C:/Qt/5.15.2/Src/qtimageformats/src/3rdparty/libtiff.pri)
+win32-g++:
+{
+        LIBS += -lz
+}
+win32-msvc*
+{
+        HEADERS += C:/Qt/5.15.2/msvc2015_64/include/QtZlib/zlib.h
+}
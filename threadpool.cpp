@@ -0,0 +1,126 @@
+#include "threadpool.h"
+#include <algorithm>
+
+using namespace std;
+
+/*!
+ * \brief Создание пула
+ * \param threads - количество потоков вместе с вызывающим run(), 0 - по числу ядер процессора
+ */
+ThreadPool::ThreadPool(unsigned threads) {
+    if(threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+    for(unsigned i = 1; i < threads; i++)
+        queues.emplace_back(new Queue);
+    for(size_t i = 0; i < queues.size(); i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(thread& worker : workers)
+        worker.join();
+}
+
+/*!
+ * \brief Выполнение count задач и ожидание их завершения
+ * \param count - количество задач
+ * \param task - функция задачи, получает номер задачи от 0 до count-1
+ */
+void ThreadPool::run(size_t count, const function<void(size_t)>& task) {
+    if(count == 0)
+        return;
+    if(workers.empty()) {
+        for(size_t i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    Job job;
+    job.task = &task;
+    job.remaining = count;
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        pending += count;
+    }
+    // Задачи раздаются очередям непрерывными блоками, дальше потоки балансируют нагрузку перехватом
+    const size_t nqueues = queues.size();
+    for(size_t q = 0; q < nqueues; q++) {
+        lock_guard<mutex> lock(queues[q]->mutex);
+        for(size_t i = q * count / nqueues; i < (q + 1) * count / nqueues; i++)
+            queues[q]->tasks.push_back({&job, i});
+    }
+    wake.notify_all();
+
+    Task current;
+    while(job.remaining.load() != 0) {
+        if(takeTask(nqueues, current)) {
+            execute(current);
+            continue;
+        }
+        unique_lock<mutex> lock(job.mutex);
+        job.done.wait(lock, [&job] { return job.remaining.load() == 0; });
+    }
+    // Дожидаемся, пока поток, завершивший последнюю задачу, отпустит job
+    lock_guard<mutex> lock(job.mutex);
+}
+
+/*!
+ * \brief Получение задачи: сначала с конца своей очереди, затем с начала чужих
+ * \param own - номер своей очереди (для вызывающего run() потока - количество очередей)
+ * \param task - полученная задача
+ * \return true, если задача получена
+ */
+bool ThreadPool::takeTask(size_t own, Task& task) {
+    const size_t nqueues = queues.size();
+    bool found = false;
+    if(own < nqueues) {
+        Queue& queue = *queues[own];
+        lock_guard<mutex> lock(queue.mutex);
+        if(!queue.tasks.empty()) {
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            found = true;
+        }
+    }
+    for(size_t i = 1; !found && i <= nqueues; i++) {
+        Queue& queue = *queues[(own + i) % nqueues];
+        lock_guard<mutex> lock(queue.mutex);
+        if(!queue.tasks.empty()) {
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            found = true;
+        }
+    }
+    if(found) {
+        lock_guard<mutex> lock(wakeMutex);
+        pending--;
+    }
+    return found;
+}
+
+void ThreadPool::execute(const Task& task) {
+    Job* job = task.job;
+    (*job->task)(task.index);
+    lock_guard<mutex> lock(job->mutex);
+    if(--job->remaining == 0)
+        job->done.notify_all();
+}
+
+void ThreadPool::workerLoop(size_t id) {
+    Task task;
+    while(true) {
+        if(takeTask(id, task)) {
+            execute(task);
+            continue;
+        }
+        unique_lock<mutex> lock(wakeMutex);
+        wake.wait(lock, [this] { return stopping || pending > 0; });
+        if(stopping && pending == 0)
+            return;
+    }
+}
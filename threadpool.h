@@ -0,0 +1,61 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+ * \brief Пул потоков с перехватом задач (work stealing).
+ * У каждого рабочего потока своя очередь: владелец берёт задачи с конца, простаивающие потоки
+ * забирают задачи с начала чужих очередей. Поток, вызвавший run(), тоже выполняет задачи,
+ * пока ждёт завершения, поэтому run() можно вызывать изнутри задач и из нескольких потоков сразу.
+ */
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Количество потоков, выполняющих задачи, вместе с вызывающим
+    unsigned threadCount() const { return unsigned(workers.size()) + 1; }
+
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    // Набор задач одного вызова run()
+    struct Job {
+        const std::function<void(size_t)>* task;
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    struct Task {
+        Job* job;
+        size_t index;
+    };
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool takeTask(size_t own, Task& task);
+    void execute(const Task& task);
+    void workerLoop(size_t id);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    size_t pending = 0; // Количество задач в очередях
+    bool stopping = false;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,179 @@
+#include "watch.h"
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+#include "batch.h"
+#if defined(__linux__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+using namespace std;
+
+DirectoryWatcher::~DirectoryWatcher() {
+    close();
+}
+
+/*!
+ * \brief Начало наблюдения за папкой. Файлы, уже лежащие в папке, ставятся в очередь.
+ * \param dir - папка
+ * \return В случае успеха вернёт true, иначе false (папка недоступна или система не поддерживает inotify)
+ */
+bool DirectoryWatcher::open(const string& dir) {
+    close();
+#if defined(__linux__)
+    this->dir = dir;
+    notifyFd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(notifyFd < 0 || pipe2(stopPipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        close();
+        return false;
+    }
+    // Наблюдение ставится до чтения списка файлов, поэтому файлы, дописанные в промежутке, не теряются
+    if(inotify_add_watch(notifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM | IN_ONLYDIR) < 0) {
+        close();
+        return false;
+    }
+    if(!rescan()) {
+        close();
+        return false;
+    }
+    return true;
+#else
+    (void)dir;
+    return false;
+#endif
+}
+
+/*!
+ * \brief Ожидание следующего полностью записанного кадра
+ * \param path - путь к кадру
+ * \return true, если кадр получен; false после stop() или при ошибке наблюдения
+ */
+bool DirectoryWatcher::next(string& path) {
+#if defined(__linux__)
+    if(notifyFd < 0)
+        return false;
+    // Если очередь не пуста, события и остановка только проверяются без ожидания
+    while(true) {
+        pollfd fds[2] = {{notifyFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+        if(poll(fds, 2, pending.empty() ? -1 : 0) < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        if(fds[1].revents != 0)
+            return false;
+        if(fds[0].revents != 0 && !readEvents())
+            return false;
+        if(!pending.empty())
+            break;
+    }
+    path = pending.front();
+    pending.pop_front();
+    queued.erase(path);
+    error_code ec;
+    issued[path] = filesystem::last_write_time(path, ec);
+    return true;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+/*!
+ * \brief Прерывание ожидания: текущий и последующие вызовы next() вернут false.
+ * Можно вызывать из обработчика сигнала.
+ */
+void DirectoryWatcher::stop() {
+#if defined(__linux__)
+    if(stopPipe[1] >= 0) {
+        const char byte = 0;
+        (void)!write(stopPipe[1], &byte, 1);
+    }
+#endif
+}
+
+void DirectoryWatcher::close() {
+#if defined(__linux__)
+    for(int* fd : {&notifyFd, &stopPipe[0], &stopPipe[1]}) {
+        if(*fd >= 0)
+            ::close(*fd);
+        *fd = -1;
+    }
+#endif
+    pending.clear();
+    queued.clear();
+    issued.clear();
+}
+
+// Разбор накопившихся событий inotify, возвращает false при ошибке чтения
+bool DirectoryWatcher::readEvents() {
+#if defined(__linux__)
+    alignas(inotify_event) char buffer[64 * 1024];
+    while(true) {
+        const ssize_t size = read(notifyFd, buffer, sizeof(buffer));
+        if(size < 0)
+            return errno == EAGAIN || errno == EINTR;
+        if(size == 0)
+            return true;
+        for(ssize_t offset = 0; offset < size;) {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            if(event->mask & IN_Q_OVERFLOW) {
+                // События потеряны: папка просматривается заново
+                rescan();
+                continue;
+            }
+            if(event->mask & IN_IGNORED)
+                return false; // Папка удалена или размонтирована
+            if(event->len == 0 || (event->mask & IN_ISDIR))
+                continue;
+            const string path = (filesystem::path(dir) / event->name).string();
+            if(event->mask & (IN_DELETE | IN_MOVED_FROM))
+                forget(path);
+            else if(isTiff(path))
+                enqueue(path);
+        }
+    }
+#else
+    return false;
+#endif
+}
+
+/* Постановка в очередь кадров папки, которые ещё не выдавались или изменились после выдачи.
+ * Записи о выданных файлах, которых больше нет в папке, удаляются.
+ */
+bool DirectoryWatcher::rescan() {
+    vector<string> existing;
+    if(!listFrames(dir, existing))
+        return false;
+    map<string, filesystem::file_time_type> present;
+    for(const string& path : existing) {
+        error_code ec;
+        const filesystem::file_time_type modified = filesystem::last_write_time(path, ec);
+        const auto it = issued.find(path);
+        if(it != issued.end()) {
+            present.insert(*it);
+            if(!ec && it->second == modified)
+                continue;
+        }
+        enqueue(path);
+    }
+    issued.swap(present);
+    return true;
+}
+
+void DirectoryWatcher::enqueue(const string& path) {
+    if(queued.insert(path).second)
+        pending.push_back(path);
+}
+
+// Удаление сведений о файле, удалённом или перенесённом из папки: он не ждёт в очереди и не помнится выданным
+void DirectoryWatcher::forget(const string& path) {
+    issued.erase(path);
+    if(queued.erase(path) != 0)
+        pending.erase(find(pending.begin(), pending.end(), path));
+}
@@ -0,0 +1,46 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+
+/*!
+ * \brief Наблюдение за папкой, в которую поступают кадры (inotify, только Linux).
+ * Кадр выдаётся, когда файл .tif/.tiff закрыт после записи или переименован в папку,
+ * то есть записан полностью. Файлы, лежащие в папке при открытии, выдаются первыми по алфавиту.
+ * Повторное событие для файла, который ещё ждёт в очереди, не ставит его в очередь второй раз.
+ * После переполнения очереди событий папка просматривается заново, но выданные ранее кадры
+ * ставятся в очередь, только если файл изменился после выдачи.
+ * Удалённые и перенесённые из папки файлы убираются из очереди и из списка выданных.
+ */
+class DirectoryWatcher {
+public:
+    DirectoryWatcher() = default;
+    ~DirectoryWatcher();
+
+    DirectoryWatcher(const DirectoryWatcher&) = delete;
+    DirectoryWatcher& operator=(const DirectoryWatcher&) = delete;
+
+    bool open(const std::string& dir);
+    bool next(std::string& path);
+    void stop();
+    void close();
+
+private:
+    bool readEvents();
+    bool rescan();
+    void enqueue(const std::string& path);
+    void forget(const std::string& path);
+
+    std::string dir;
+    int notifyFd = -1;
+    int stopPipe[2] = {-1, -1}; // Запись в stopPipe[1] будит ожидающий next()
+    std::deque<std::string> pending;
+    std::set<std::string> queued; // Пути в pending
+    std::map<std::string, std::filesystem::file_time_type> issued; // Выданные кадры и время их изменения при выдаче
+};
+
+#endif // WATCH_H